@@ -19,6 +19,9 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <check.h>
 #include "mm.h"
 
@@ -389,6 +392,947 @@ START_TEST (test_memory_exerciser)
 
 END_TEST
 
+/**
+ * @name   test_size_class_reuse
+ * @brief  Tests whether freed blocks are found again once the arena is used up.
+ *
+ * The arena is filled with 1 MB blocks, every other block is freed, and the
+ * same number of 1 MB blocks is requested again. The next-fit block is too
+ * small by then, so each request must be served from the size class lists
+ * without overlapping any of the blocks still in use.
+ */
+START_TEST (test_size_class_reuse)
+{
+    char *ptrs[64];
+    char *again[32];
+    int n = 0, i, j;
+    size_t size = 1024 * 1024;
+
+    while (n < 64 && (ptrs[n] = MALLOC(size)) != NULL) n++;
+    ck_assert_msg(n > 2 && n < 64, "Arena should be exhausted by 1 MB blocks");
+
+    for (i = 0; i < n; i += 2) {
+        FREE(ptrs[i]);
+    }
+
+    for (i = 0; i < n; i += 2) {
+        char *p = MALLOC(size);
+        ck_assert_msg(p != NULL, "Freed memory was not reused");
+        for (j = 1; j < n; j += 2) {
+            ck_assert(p + size <= ptrs[j] || ptrs[j] + size <= p);
+        }
+        again[i / 2] = p;
+    }
+
+    for (i = 0; i < n; i++) {
+        FREE((i % 2) ? ptrs[i] : again[i / 2]);
+    }
+}
+END_TEST
+
+/**
+ * @name   test_coalescing_with_previous
+ * @brief  Tests whether a freed block is merged with a free block before it.
+ *
+ * With the arena used up by 1 MB blocks, two neighbours are freed in
+ * address order. Only merging the second one backwards into the first
+ * gives a free block large enough for a 2 MB request.
+ */
+START_TEST (test_coalescing_with_previous)
+{
+    char *ptrs[64];
+    char *big;
+    int n = 0, i;
+    size_t size = 1024 * 1024;
+
+    while (n < 64 && (ptrs[n] = MALLOC(size)) != NULL) n++;
+    ck_assert_msg(n > 3 && n < 64, "Arena should be exhausted by 1 MB blocks");
+
+    FREE(ptrs[1]);
+    FREE(ptrs[2]);
+
+    big = MALLOC(2 * size);
+    ck_assert_msg(big != NULL, "Neighbouring free blocks were not merged");
+    ck_assert(big <= ptrs[1]);
+
+    FREE(big);
+    for (i = 0; i < n; i++) {
+        if (i != 1 && i != 2) FREE(ptrs[i]);
+    }
+}
+END_TEST
+
+#define CHURN_THREADS     4
+#define CHURN_SLOTS       64
+#define CHURN_ITERATIONS  20000
+
+/**
+ * @name   Thread body of test_threaded_churn
+ * @brief  Allocates and frees blocks of random sizes, checking that no other thread wrote into them.
+ * @retval NULL if all blocks kept their contents.
+ */
+static void *churn_thread(void *arg)
+{
+  uint32_t seed = (uint32_t) (uintptr_t) arg;
+  uint32_t *data[CHURN_SLOTS] = { 0 };
+  uint32_t words[CHURN_SLOTS];
+  uint32_t i, n, k;
+  void *ret = NULL;
+
+  for (i = 0; i < CHURN_ITERATIONS; i++) {
+    seed = seed * 1103515245 + 12345;
+    k = (seed >> 16) % CHURN_SLOTS;
+    if (data[k] != NULL) {
+      for (n = 0; n < words[k]; n++) {
+        if (data[k][n] != (uint32_t) (uintptr_t) arg + k) ret = arg;
+      }
+      FREE(data[k]);
+      data[k] = NULL;
+    } else {
+      /* Mostly sizes served by the thread cache, with some larger ones in between */
+      words[k] = 1 + (seed >> 8) % ((seed & 1) ? 32 : 512);
+      data[k] = MALLOC(words[k] * sizeof(uint32_t));
+      if (data[k] == NULL) return arg;
+      for (n = 0; n < words[k]; n++) {
+        data[k][n] = (uint32_t) (uintptr_t) arg + k;
+      }
+    }
+  }
+  for (k = 0; k < CHURN_SLOTS; k++) {
+    FREE(data[k]);
+  }
+  return ret;
+}
+
+/**
+ * @name   test_threaded_churn
+ * @brief  Tests whether several threads can allocate and free at the same time.
+ */
+START_TEST (test_threaded_churn)
+{
+  pthread_t threads[CHURN_THREADS];
+  void *ret;
+  uintptr_t t;
+
+  for (t = 0; t < CHURN_THREADS; t++) {
+    ck_assert(pthread_create(&threads[t], NULL, churn_thread, (void *) ((t + 1) << 16)) == 0);
+  }
+  for (t = 0; t < CHURN_THREADS; t++) {
+    pthread_join(threads[t], &ret);
+    ck_assert_msg(ret == NULL, "Thread %d found a corrupted block", (int) t);
+  }
+}
+END_TEST
+
+/**
+ * @name   test_arena_fallback
+ * @brief  Tests whether one thread can use memory beyond its own arena.
+ *
+ * The managed memory is split into arenas, and a thread allocates from
+ * the arena assigned to it first. Once that one is full, the other arenas
+ * must be used, so nearly all of the memory is still reachable from a
+ * single thread.
+ */
+START_TEST (test_arena_fallback)
+{
+    void *ptrs[64];
+    int n = 0, i;
+    size_t size = 1024 * 1024;
+
+    while (n < 64 && (ptrs[n] = MALLOC(size)) != NULL) n++;
+    ck_assert_msg(n * size >= (memory_end - memory_start) / 4 * 3,
+                  "Only %d MB could be allocated", n);
+
+    for (i = 0; i < n; i++) {
+        FREE(ptrs[i]);
+    }
+}
+END_TEST
+
+#define PIPELINE_ROUNDS  40
+#define PIPELINE_BLOCKS  16
+#define PIPELINE_SIZE    (256 * 1024)
+
+/**
+ * @name   Producer of test_producer_consumer
+ * @brief  Allocates PIPELINE_BLOCKS blocks and fills each with its own index.
+ */
+static void *pipeline_producer(void *arg)
+{
+  uint32_t **blocks = (uint32_t **) arg;
+  uint32_t i, n;
+
+  for (i = 0; i < PIPELINE_BLOCKS; i++) {
+    blocks[i] = MALLOC(PIPELINE_SIZE);
+    if (blocks[i] == NULL) return arg;
+    for (n = 0; n < PIPELINE_SIZE / sizeof(uint32_t); n++) {
+      blocks[i][n] = i;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @name   Consumer of test_producer_consumer
+ * @brief  Checks and frees the blocks handed over by the producer.
+ */
+static void *pipeline_consumer(void *arg)
+{
+  uint32_t **blocks = (uint32_t **) arg;
+  uint32_t i;
+  void *ret = NULL;
+
+  for (i = 0; i < PIPELINE_BLOCKS; i++) {
+    if (blocks[i][PIPELINE_SIZE / sizeof(uint32_t) - 1] != i) ret = arg;
+    FREE(blocks[i]);
+  }
+  return ret;
+}
+
+/**
+ * @name   test_producer_consumer
+ * @brief  Tests whether blocks freed by another thread than the allocating one are reused.
+ *
+ * Every round a new producer thread allocates 4 MB and a new consumer
+ * thread frees it again. In total far more than the managed memory is
+ * allocated, so the rounds only succeed if the remotely freed blocks are
+ * returned to their arenas.
+ */
+START_TEST (test_producer_consumer)
+{
+  uint32_t *blocks[PIPELINE_BLOCKS];
+  pthread_t producer, consumer;
+  void *ret;
+  int r;
+
+  for (r = 0; r < PIPELINE_ROUNDS; r++) {
+    ck_assert(pthread_create(&producer, NULL, pipeline_producer, blocks) == 0);
+    pthread_join(producer, &ret);
+    ck_assert_msg(ret == NULL, "Allocation failed in round %d", r);
+
+    ck_assert(pthread_create(&consumer, NULL, pipeline_consumer, blocks) == 0);
+    pthread_join(consumer, &ret);
+    ck_assert_msg(ret == NULL, "Corrupted block in round %d", r);
+  }
+}
+END_TEST
+
+#define SLAB_OBJECTS  5000
+
+/**
+ * @name   test_slab_cache
+ * @brief  Tests allocation of many equally sized objects from a slab cache.
+ *
+ * Objects must be unique, 8 byte aligned and keep their contents. Objects
+ * allocated one after the other from a fresh cache are packed without any
+ * header in between, and a freed object is handed out again first.
+ */
+START_TEST (test_slab_cache)
+{
+    SlabCache *cache = simple_slab_create(24);
+    uint64_t *objs[SLAB_OBJECTS];
+    uint64_t *again;
+    int i, n;
+
+    ck_assert(cache != NULL);
+    for (i = 0; i < SLAB_OBJECTS; i++) {
+        objs[i] = simple_slab_alloc(cache);
+        ck_assert(objs[i] != NULL);
+        ck_assert_msg(((uintptr_t) objs[i] % 8) == 0, "Object not aligned to 8-byte boundary!");
+        for (n = 0; n < 3; n++) objs[i][n] = i;
+    }
+    ck_assert_msg((char *) objs[1] - (char *) objs[0] == 24, "Objects are not packed");
+
+    for (i = 0; i < SLAB_OBJECTS; i++) {
+        for (n = 0; n < 3; n++) ck_assert(objs[i][n] == (uint64_t) i);
+    }
+
+    simple_slab_free(cache, objs[100]);
+    again = simple_slab_alloc(cache);
+    ck_assert(again == objs[100]);
+
+    // Free every other object first, so slabs go from full to partial to empty
+    for (i = 0; i < SLAB_OBJECTS; i += 2) simple_slab_free(cache, objs[i]);
+    for (i = 1; i < SLAB_OBJECTS; i += 2) simple_slab_free(cache, objs[i]);
+
+    for (i = 0; i < SLAB_OBJECTS; i++) {
+        objs[i] = simple_slab_alloc(cache);
+        ck_assert(objs[i] != NULL);
+    }
+    simple_slab_destroy(cache);
+
+    ck_assert(simple_slab_create(1024 * 1024) == NULL);
+}
+END_TEST
+
+/**
+ * @name   test_realloc_in_place
+ * @brief  Tests whether simple_realloc resizes in place when possible and keeps the contents.
+ *
+ * Three consecutive blocks are allocated and the middle one is freed. The
+ * first block can then grow into the middle one and shrink again without
+ * moving, while growing past the third block has to move it.
+ */
+START_TEST (test_realloc_in_place)
+{
+    char *ptr1, *ptr2, *ptr3, *ptr4;
+    int size = 1000;
+    int i;
+
+    ptr1 = MALLOC(size);
+    ptr2 = MALLOC(size);
+    ptr3 = MALLOC(size);
+    ck_assert(ptr1 != NULL && ptr2 != NULL && ptr3 != NULL);
+    ck_assert_msg(ptr1 < ptr2 && ptr2 < ptr3, "Blocks are not consecutive");
+    for (i = 0; i < size; i++) ptr1[i] = (char) i;
+
+    FREE(ptr2);
+
+    ptr4 = simple_realloc(ptr1, size + size / 2);
+    ck_assert_msg(ptr4 == ptr1, "Block did not grow in place");
+    for (i = size; i < size + size / 2; i++) ptr4[i] = (char) i;
+
+    ptr4 = simple_realloc(ptr1, size / 2);
+    ck_assert_msg(ptr4 == ptr1, "Block did not shrink in place");
+
+    ptr4 = simple_realloc(ptr1, 4 * size);
+    ck_assert(ptr4 != NULL);
+    ck_assert_msg(ptr4 != ptr1, "Block grew over a block in use");
+    for (i = 0; i < size / 2; i++) ck_assert(ptr4[i] == (char) i);
+
+    ck_assert(simple_realloc(ptr4, 0) == NULL);
+    ptr4 = simple_realloc(NULL, size);
+    ck_assert(ptr4 != NULL);
+
+    FREE(ptr3);
+    FREE(ptr4);
+}
+END_TEST
+
+/**
+ * @name   test_calloc_zeroed
+ * @brief  Tests whether simple_calloc returns zeroed memory, both fresh and reused.
+ *
+ * Reused memory is dirtied first, so it must be cleared by simple_calloc.
+ * The last request is larger than any free block, so whatever earlier tests
+ * left behind, it partly takes new memory grown into a reserve, which is not
+ * cleared as it was never handed out. Blocks are kept in the arenas instead
+ * of being mapped on their own.
+ */
+START_TEST (test_calloc_zeroed)
+{
+    size_t sizes[] = { 4, 100, 1000, 4096, 4 * 1024 * 1024 };
+    unsigned char *ptr;
+    size_t i, n, fresh;
+
+    simple_set_mmap_threshold(0);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        ptr = MALLOC(sizes[i]);
+        ck_assert(ptr != NULL);
+        for (n = 0; n < sizes[i]; n++) ptr[n] = 0xAB;
+        FREE(ptr);
+
+        ptr = simple_calloc(sizes[i], 1);
+        ck_assert(ptr != NULL);
+        for (n = 0; n < sizes[i]; n++) {
+            ck_assert_msg(ptr[n] == 0, "Byte %d of %d not zero", (int) n, (int) sizes[i]);
+        }
+        FREE(ptr);
+    }
+
+    fresh = (simple_mallinfo().largest_free + 1024 * 1024) / 4;
+    ck_assert(simple_reserve(8 * fresh) == 0);
+    ptr = simple_calloc(fresh, 4);
+    ck_assert(ptr != NULL);
+    for (n = 0; n < 4 * fresh; n++) ck_assert(ptr[n] == 0);
+    FREE(ptr);
+
+    ck_assert_msg(simple_calloc(SIZE_MAX / 2, 4) == NULL, "Size overflow not detected");
+    simple_set_mmap_threshold(4 * 1024 * 1024);
+}
+END_TEST
+
+/**
+ * @name   test_aligned_alloc
+ * @brief  Tests whether simple_aligned_alloc returns unique blocks at the requested alignment.
+ *
+ * Blocks of different alignments are interleaved, so each one starts from
+ * a misaligned position. Each block is filled to detect overlaps.
+ */
+START_TEST (test_aligned_alloc)
+{
+    size_t alignments[] = { 16, 32, 64, 4096 };
+    unsigned char *ptrs[4][8];
+    size_t size = 100;
+    size_t a, i, n;
+
+    for (i = 0; i < 8; i++) {
+        for (a = 0; a < 4; a++) {
+            ptrs[a][i] = simple_aligned_alloc(alignments[a], size + i);
+            ck_assert(ptrs[a][i] != NULL);
+            ck_assert_msg(((uintptr_t) ptrs[a][i] % alignments[a]) == 0,
+                          "Memory not aligned to %d-byte boundary!", (int) alignments[a]);
+            for (n = 0; n < size + i; n++) ptrs[a][i][n] = (unsigned char) (a * 8 + i);
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (a = 0; a < 4; a++) {
+            for (n = 0; n < size + i; n++) ck_assert(ptrs[a][i][n] == (unsigned char) (a * 8 + i));
+            FREE(ptrs[a][i]);
+        }
+    }
+
+    ck_assert_msg(simple_aligned_alloc(24, size) == NULL, "Alignment must be a power of two");
+}
+END_TEST
+
+/**
+ * @name   Smallest fit scenario
+ * @brief  Checks that policy picks the smallest free block that fits.
+ *
+ * Three free blocks of different sizes are left between blocks in use. Each
+ * request must be served by the smallest of them that is large enough,
+ * where next fit would have taken the free memory after the last block.
+ */
+static void check_smallest_fit(PlacementPolicy policy)
+{
+    char *big, *small, *medium, *guards[3];
+    char *ptr;
+
+    /* Lay out the blocks next to each other with next fit */
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+
+    /* Odd sizes, so blocks left free by other tests are unlikely to fit better */
+    big = MALLOC(3352);
+    guards[0] = MALLOC(1000);
+    small = MALLOC(1112);
+    guards[1] = MALLOC(1000);
+    medium = MALLOC(2232);
+    guards[2] = MALLOC(1000);
+
+    ck_assert(simple_set_policy(policy) == 0);
+    FREE(big);
+    FREE(small);
+    FREE(medium);
+
+    ptr = MALLOC(1100);
+    ck_assert_msg(ptr == small, "Policy did not pick the smallest block");
+    FREE(ptr);
+    ptr = MALLOC(2200);
+    ck_assert_msg(ptr == medium, "Policy did not pick the medium block");
+    FREE(ptr);
+    ptr = MALLOC(3300);
+    ck_assert_msg(ptr == big, "Policy did not pick the largest block");
+    FREE(ptr);
+
+    FREE(guards[0]);
+    FREE(guards[1]);
+    FREE(guards[2]);
+
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+}
+
+/**
+ * @name   test_best_fit_policy
+ * @brief  Tests whether the best fit policy picks the smallest free block that fits.
+ */
+START_TEST (test_best_fit_policy)
+{
+    check_smallest_fit(MM_BEST_FIT);
+    ck_assert(simple_set_policy((PlacementPolicy) 42) == -1);
+}
+END_TEST
+
+/**
+ * @name   test_good_fit_policy
+ * @brief  Tests whether the good fit policy picks the smallest free block when there are few.
+ */
+START_TEST (test_good_fit_policy)
+{
+    check_smallest_fit(MM_GOOD_FIT);
+}
+END_TEST
+
+/**
+ * @name   test_first_fit_policy
+ * @brief  Tests whether the first fit policy picks the first free block that fits.
+ *
+ * The same pattern as test_not_first_fit_strategy, with blocks too large for
+ * the thread cache, must now reuse the first block, which comes before the
+ * others in the block list of their region.
+ */
+START_TEST (test_first_fit_policy)
+{
+    char *ptr1, *ptr2, *ptr3, *ptr4;
+    int size = 1000;
+
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+    ptr1 = MALLOC(size);
+    ptr2 = MALLOC(size);
+    ptr3 = MALLOC(size);
+    ck_assert(ptr1 != NULL && ptr2 != NULL && ptr3 != NULL);
+
+    ck_assert(simple_set_policy(MM_FIRST_FIT) == 0);
+    FREE(ptr1);
+    FREE(ptr3);
+
+    ptr4 = MALLOC(size);
+    ck_assert_msg(ptr4 <= ptr1, "First fit did not pick the first block");
+
+    FREE(ptr2);
+    FREE(ptr4);
+
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+}
+END_TEST
+
+/**
+ * @name   test_size_class_split
+ * @brief  Tests whether a request is served from the closest size class that fits.
+ *
+ * Both free blocks lie in the same power of two range, but only the smaller
+ * one is in a class just above the request. It must be taken in preference
+ * to the other one, freed last and so first in its list.
+ */
+START_TEST (test_size_class_split)
+{
+    char *near, *far, *guards[2];
+    char *ptr;
+
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+    near = MALLOC(2504);
+    guards[0] = MALLOC(1000);
+    far = MALLOC(3896);
+    guards[1] = MALLOC(1000);
+
+    ck_assert(simple_set_policy(MM_GOOD_FIT) == 0);
+    FREE(near);
+    FREE(far);
+
+    ptr = MALLOC(2000);
+    ck_assert_msg(ptr != NULL && ptr != far, "Request was not served from the closest size class");
+    FREE(ptr);
+
+    FREE(guards[0]);
+    FREE(guards[1]);
+
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+}
+END_TEST
+
+/**
+ * @name   test_realtime_bounds
+ * @brief  Tests whether the real-time policy keeps the cost of malloc and free bounded on a fragmented heap.
+ *
+ * All memory is used up by blocks of RT_BLOCK bytes, every other one of
+ * which is freed again if it lies right between its neighbours, so that
+ * none of them can merge. Every free block then shares the size class of a
+ * slightly larger request without fitting it, which a first-fit search of
+ * that class has to walk through before failing. A request of RT_FIT bytes
+ * is served from one of them, and freeing it merges it with what is left.
+ *
+ * Each of these, the failing malloc, the successful one and the free, must
+ * cost no more than RT_FACTOR times a malloc and free on the unfragmented
+ * heap, counted in cycles. The cheapest of several tries is compared, as
+ * the bound is on the work done, not on interrupts or cache misses that
+ * may hit any single try.
+ */
+#define RT_BLOCK   1000
+#define RT_FIT     600     /* In a class below that of RT_BLOCK, and too large for the thread cache */
+#define RT_MIN     16      /* Bytes of free memory that any block, with its header, takes at least */
+#define RT_SLACK   1024    /* Blocks that may come from the thread cache instead */
+#define RT_TRIES   64
+#define RT_FACTOR  16
+
+static inline uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+START_TEST (test_realtime_bounds)
+{
+    uint64_t start, cost, base = UINT64_MAX;
+    uint64_t cheapest_fail = UINT64_MAX, cheapest_fit = UINT64_MAX, cheapest_free = UINT64_MAX;
+    char *ptr, **rt_ptrs;
+    size_t n = 0, max, blocks, i;
+
+    ck_assert(simple_set_policy(MM_REALTIME) == 0);
+    for (i = 0; i < RT_TRIES; i++) {
+        start = cycles();
+        ptr = MALLOC(RT_BLOCK + 16);
+        FREE(ptr);
+        cost = cycles() - start;
+        ck_assert(ptr != NULL);
+        if (cost < base) base = cost;
+    }
+
+    /* Fill up exactly, then plug any holes left so the freed blocks cannot merge */
+    max = simple_mallinfo().free / RT_MIN + RT_SLACK;
+    rt_ptrs = malloc(max * sizeof(char *));
+    ck_assert(rt_ptrs != NULL);
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+    while (n < max && (rt_ptrs[n] = MALLOC(RT_BLOCK)) != NULL) n++;
+    blocks = n;
+    while (n < max && (rt_ptrs[n] = MALLOC(8)) != NULL) n++;
+    ck_assert_msg(n < max, "Memory should be used up");
+    for (i = 1; i + 1 < blocks; i += 2) {
+        if (rt_ptrs[i] - rt_ptrs[i - 1] == rt_ptrs[i + 1] - rt_ptrs[i] && rt_ptrs[i] - rt_ptrs[i - 1] < 2 * RT_BLOCK) {
+            FREE(rt_ptrs[i]);
+            rt_ptrs[i] = NULL;
+        }
+    }
+
+    ck_assert(simple_set_policy(MM_REALTIME) == 0);
+    for (i = 0; i < RT_TRIES; i++) {
+        start = cycles();
+        ptr = MALLOC(RT_BLOCK + 16);
+        cost = cycles() - start;
+        ck_assert(ptr == NULL);
+        if (cost < cheapest_fail) cheapest_fail = cost;
+
+        start = cycles();
+        ptr = MALLOC(RT_FIT);
+        cost = cycles() - start;
+        ck_assert(ptr != NULL);
+        if (cost < cheapest_fit) cheapest_fit = cost;
+
+        start = cycles();
+        FREE(ptr);
+        cost = cycles() - start;
+        if (cost < cheapest_free) cheapest_free = cost;
+    }
+    ck_assert_msg(cheapest_fail <= RT_FACTOR * base, "Failed allocation took %llu cycles, against %llu unfragmented",
+                  (unsigned long long) cheapest_fail, (unsigned long long) base);
+    ck_assert_msg(cheapest_fit <= RT_FACTOR * base, "Allocation took %llu cycles, against %llu unfragmented",
+                  (unsigned long long) cheapest_fit, (unsigned long long) base);
+    ck_assert_msg(cheapest_free <= RT_FACTOR * base, "Free took %llu cycles, against %llu unfragmented",
+                  (unsigned long long) cheapest_free, (unsigned long long) base);
+
+    for (i = 0; i < n; i++) {
+        FREE(rt_ptrs[i]);
+    }
+    free(rt_ptrs);
+    ck_assert(simple_set_policy(MM_NEXT_FIT) == 0);
+}
+END_TEST
+
+/**
+ * @name   test_mallinfo
+ * @brief  Tests whether the statistics follow allocations and frees.
+ *
+ * Freeing a block right after allocating it must restore the counts of
+ * both allocated and free memory, while the call counts only go up. The
+ * slab allocator does not count as calls of malloc or free.
+ */
+START_TEST (test_mallinfo)
+{
+    SimpleMallinfo before, during, after;
+    SlabCache *cache;
+    char *ptr;
+
+    before = simple_mallinfo();
+    ptr = MALLOC(1000);
+    ck_assert(ptr != NULL);
+    ptr = simple_realloc(ptr, 2000);
+    ck_assert(ptr != NULL);
+    during = simple_mallinfo();
+
+    ck_assert(during.in_use >= before.in_use + 2000 && during.in_use < before.in_use + 2100);
+    ck_assert(during.used_blocks == before.used_blocks + 1);
+    ck_assert(during.free <= before.free - 2000);
+    ck_assert(during.peak >= during.in_use);
+    ck_assert(during.largest_free > 0 && during.largest_free <= during.free);
+    ck_assert(during.malloc_calls == before.malloc_calls + 1);
+    ck_assert(during.realloc_calls == before.realloc_calls + 1);
+    ck_assert(during.free_calls == before.free_calls);
+
+    FREE(ptr);
+    after = simple_mallinfo();
+    ck_assert(after.in_use == before.in_use);
+    ck_assert(after.used_blocks == before.used_blocks);
+    ck_assert(after.free == before.free && after.free_blocks == before.free_blocks);
+    ck_assert(after.peak == during.peak);
+    ck_assert(after.free_calls == before.free_calls + 1);
+
+    cache = simple_slab_create(48);
+    ck_assert(cache != NULL);
+    simple_slab_free(cache, simple_slab_alloc(cache));
+    simple_slab_destroy(cache);
+    during = simple_mallinfo();
+    ck_assert(during.malloc_calls == after.malloc_calls && during.free_calls == after.free_calls);
+}
+END_TEST
+
+/**
+ * @name   test_latency_histograms
+ * @brief  Tests whether the latency of each call is recorded in the size class of its request.
+ */
+#define LAT_CALLS_MADE  1000
+
+START_TEST (test_latency_histograms)
+{
+    LatencySummary sum;
+    char *ptr;
+    int i;
+
+    simple_latency_enable(0);   /* Recording may be on from the start, then only restarting clears it */
+    simple_latency_enable(1);
+    for (i = 0; i < LAT_CALLS_MADE; i++) {
+        ptr = MALLOC(100);   /* Class 2, below 2^9 bytes */
+        ck_assert(ptr != NULL);
+        FREE(ptr);
+    }
+    simple_latency_enable(0);
+    FREE(MALLOC(100));
+
+    sum = simple_latency(MM_LATENCY_MALLOC, 2);
+    ck_assert_int_eq(sum.count, LAT_CALLS_MADE);
+    ck_assert(sum.p50 <= sum.p99 && sum.p99 <= sum.p999 && sum.p999 <= sum.max);
+    ck_assert_int_eq(simple_latency(MM_LATENCY_MALLOC, 3).count, 0);
+    ck_assert_int_eq(simple_latency(MM_LATENCY_MALLOC, -1).count, LAT_CALLS_MADE);
+    ck_assert_int_eq(simple_latency(MM_LATENCY_FREE, -1).count, LAT_CALLS_MADE);
+
+    /* Starting again clears the counts */
+    simple_latency_enable(1);
+    simple_latency_enable(0);
+    ck_assert_int_eq(simple_latency(MM_LATENCY_MALLOC, -1).count, 0);
+}
+END_TEST
+
+/**
+ * @name   test_fragmentation
+ * @brief  Tests whether fragmentation is measured on free blocks kept apart by blocks in use.
+ *
+ * Freeing every other block leaves free blocks that can only be merged with
+ * free memory around them, if any. None of them may be left next to another
+ * free block, and the totals must match those of simple_mallinfo.
+ */
+START_TEST (test_fragmentation)
+{
+    FragmentationInfo after;
+    char *ptrs[8];
+    size_t counted = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        ptrs[i] = MALLOC(1000);
+        ck_assert(ptrs[i] != NULL);
+    }
+    for (i = 0; i < 8; i += 2) {
+        FREE(ptrs[i]);
+    }
+    after = simple_fragmentation();
+
+    ck_assert_int_eq(after.uncoalesced, 0);
+    ck_assert(after.largest_free >= 1000);
+    ck_assert(after.histogram[63 - __builtin_clzll(after.largest_free)] > 0);
+    for (i = 0; i < MM_FRAG_BUCKETS; i++) {
+        counted += after.histogram[i];
+    }
+    ck_assert_int_eq(counted, after.free_blocks);
+    ck_assert(after.largest_free <= after.total_free);
+    ck_assert(after.external >= 0.0 && after.external < 1.0);
+    ck_assert_int_eq(after.total_free, simple_mallinfo().free);
+
+    for (i = 1; i < 8; i += 2) {
+        FREE(ptrs[i]);
+    }
+}
+END_TEST
+
+/**
+ * @name   test_trace
+ * @brief  Tests whether calls made while tracing are written to the trace file in order.
+ */
+#define TRACE_FILE  "check_mm.trace"
+
+START_TEST (test_trace)
+{
+    static const char magic[8] = MM_TRACE_MAGIC;
+    TraceRecord recs[4];
+    char head[8];
+    char *ptr, *moved;
+    FILE *f;
+
+    ck_assert(simple_trace_start(TRACE_FILE) == 0);
+    ck_assert(simple_trace_start(TRACE_FILE) == -1);
+    ptr = MALLOC(1000);
+    moved = simple_realloc(ptr, 100000);
+    FREE(NULL);
+    FREE(moved);
+    simple_trace_stop();
+    FREE(MALLOC(10));   /* Not recorded any more */
+
+    f = fopen(TRACE_FILE, "rb");
+    ck_assert(f != NULL);
+    ck_assert(fread(head, 1, sizeof(head), f) == sizeof(head) && memcmp(head, magic, sizeof(magic)) == 0);
+    ck_assert(fread(recs, sizeof(TraceRecord), 4, f) == 3);
+    fclose(f);
+    remove(TRACE_FILE);
+
+    ck_assert(recs[0].op == MM_TRACE_MALLOC && recs[0].size == 1000 && recs[0].addr == (uintptr_t) ptr);
+    ck_assert(recs[1].op == MM_TRACE_REALLOC && recs[1].size == 100000 && recs[1].old == (uintptr_t) ptr &&
+              recs[1].addr == (uintptr_t) moved);
+    ck_assert(recs[2].op == MM_TRACE_FREE && recs[2].addr == (uintptr_t) moved);
+    ck_assert(recs[0].thread != 0 && recs[1].thread == recs[0].thread);
+    ck_assert(recs[0].time <= recs[1].time && recs[1].time <= recs[2].time);
+}
+END_TEST
+
+/**
+ * @name   test_init_region
+ * @brief  Tests whether memory handed in with simple_init_region is used.
+ *
+ * Once all other memory is taken, blocks must come from the new region.
+ * Regions overlapping a managed one or too small to hold a block are refused.
+ */
+#define REGION_SIZE  (2 * 1024 * 1024)
+#define REGION_BLOCK (1024 * 1024)
+
+static int8_t region[REGION_SIZE];
+
+START_TEST (test_init_region)
+{
+    void *ptrs[128];
+    int i, n, inside = 0;
+
+    ck_assert(simple_init_region(region, REGION_SIZE) == 0);
+    ck_assert(simple_init_region(region + REGION_SIZE / 2, REGION_SIZE) == -1);
+    ck_assert(simple_init_region(ptrs, 16) == -1);
+
+    for (n = 0; n < 128 && (ptrs[n] = MALLOC(REGION_BLOCK)) != NULL; n++) {
+        if ((int8_t *) ptrs[n] >= region && (int8_t *) ptrs[n] + REGION_BLOCK <= region + REGION_SIZE) {
+            inside++;
+        }
+    }
+    ck_assert_msg(inside == 1, "The added region was not used");
+
+    for (i = 0; i < n; i++) {
+        FREE(ptrs[i]);
+    }
+}
+END_TEST
+
+/**
+ * @name   test_heap_growth
+ * @brief  Tests whether the memory grows into a reserve once it is used up.
+ */
+#define GROWTH_RESERVE  (64 * 1024 * 1024)
+#define GROWTH_BLOCK    (1024 * 1024)
+#define GROWTH_MAX      (256)
+
+START_TEST (test_heap_growth)
+{
+    static char *ptrs[GROWTH_MAX];
+    int i, n;
+
+    ck_assert(simple_reserve(GROWTH_RESERVE) == 0);
+
+    for (n = 0; n < GROWTH_MAX && (ptrs[n] = MALLOC(GROWTH_BLOCK)) != NULL; n++) {
+        ptrs[n][0] = 1;
+        ptrs[n][GROWTH_BLOCK - 1] = 1;
+    }
+    ck_assert_msg(n < GROWTH_MAX, "The reserve was not used up");
+    ck_assert_msg((size_t) n * GROWTH_BLOCK >= (memory_end - memory_start) + GROWTH_RESERVE / 4 * 3,
+                  "Only %d MB could be allocated", n);
+
+    for (i = 0; i < n; i++) {
+        FREE(ptrs[i]);
+    }
+}
+END_TEST
+
+/**
+ * @name   test_trim
+ * @brief  Tests whether simple_trim releases free memory without touching blocks in use.
+ */
+#define TRIM_SIZE  (3 * 1024 * 1024)
+
+START_TEST (test_trim)
+{
+    char *used, *freed, *again;
+    int i;
+
+    used = MALLOC(TRIM_SIZE);
+    freed = MALLOC(TRIM_SIZE);
+    ck_assert(used != NULL && freed != NULL);
+    memset(used, 0x5A, TRIM_SIZE);
+    memset(freed, 0xA5, TRIM_SIZE);
+    FREE(freed);
+
+    ck_assert_msg(simple_trim() >= TRIM_SIZE - 2 * 4096, "The freed block was not released");
+
+    for (i = 0; i < TRIM_SIZE; i++) {
+        if (used[i] != 0x5A) break;
+    }
+    ck_assert_msg(i == TRIM_SIZE, "Block in use changed at offset %d", i);
+
+    // Released memory must still be usable
+    again = MALLOC(TRIM_SIZE);
+    ck_assert(again != NULL);
+    memset(again, 0x3C, TRIM_SIZE);
+    ck_assert(again[TRIM_SIZE - 1] == 0x3C);
+
+    FREE(again);
+    FREE(used);
+}
+END_TEST
+
+/**
+ * @name   test_mmap_threshold
+ * @brief  Tests whether huge blocks are mapped on their own and still behave like other blocks.
+ */
+#define HUGE_SIZE  (3 * 1024 * 1024)
+
+START_TEST (test_mmap_threshold)
+{
+    unsigned char *ptr, *grown;
+    size_t n;
+
+    simple_set_mmap_threshold(HUGE_SIZE);
+
+    ptr = MALLOC(HUGE_SIZE);
+    ck_assert(ptr != NULL);
+    ck_assert_msg((uintptr_t) ptr < memory_start || (uintptr_t) ptr >= memory_end, "Huge block taken from the heap");
+    for (n = 0; n < HUGE_SIZE; n++) ptr[n] = (unsigned char) n;
+
+    grown = simple_realloc(ptr, 2 * HUGE_SIZE);
+    ck_assert(grown != NULL);
+    for (n = 0; n < HUGE_SIZE; n++) {
+        ck_assert_msg(grown[n] == (unsigned char) n, "Byte %d not kept by realloc", (int) n);
+    }
+    ptr = simple_realloc(grown, 100);
+    ck_assert(ptr != NULL);
+    ck_assert(ptr[99] == 99);
+    FREE(ptr);
+
+    ptr = simple_calloc(HUGE_SIZE, 1);
+    ck_assert(ptr != NULL);
+    for (n = 0; n < HUGE_SIZE; n++) ck_assert(ptr[n] == 0);
+    FREE(ptr);
+
+    ptr = simple_aligned_alloc(4096, HUGE_SIZE);
+    ck_assert(ptr != NULL && ((uintptr_t) ptr & 4095) == 0);
+    ptr[HUGE_SIZE - 1] = 1;
+    FREE(ptr);
+
+    simple_set_mmap_threshold(0);
+    ptr = MALLOC(HUGE_SIZE);
+    ck_assert(ptr != NULL);
+    ck_assert_msg(simple_realloc(ptr, HUGE_SIZE / 2) == ptr, "Heap block not shrunk in place");
+    FREE(ptr);
+
+    simple_set_mmap_threshold(4 * 1024 * 1024);
+}
+END_TEST
+
 /**
  * { You may provide more unit tests here, but remember to add them to simple_malloc_suite }
  */
@@ -413,6 +1357,28 @@ Suite* simple_malloc_suite()
   tcase_add_test(tc_core, test_coalescing_blocks);
   tcase_add_test(tc_core, test_memory_alignment);
   tcase_add_test(tc_core, test_not_first_fit_strategy);
+  tcase_add_test(tc_core, test_size_class_reuse);
+  tcase_add_test(tc_core, test_coalescing_with_previous);
+  tcase_add_test(tc_core, test_threaded_churn);
+  tcase_add_test(tc_core, test_arena_fallback);
+  tcase_add_test(tc_core, test_producer_consumer);
+  tcase_add_test(tc_core, test_slab_cache);
+  tcase_add_test(tc_core, test_realloc_in_place);
+  tcase_add_test(tc_core, test_calloc_zeroed);
+  tcase_add_test(tc_core, test_aligned_alloc);
+  tcase_add_test(tc_core, test_best_fit_policy);
+  tcase_add_test(tc_core, test_good_fit_policy);
+  tcase_add_test(tc_core, test_first_fit_policy);
+  tcase_add_test(tc_core, test_size_class_split);
+  tcase_add_test(tc_core, test_realtime_bounds);
+  tcase_add_test(tc_core, test_mallinfo);
+  tcase_add_test(tc_core, test_latency_histograms);
+  tcase_add_test(tc_core, test_fragmentation);
+  tcase_add_test(tc_core, test_trace);
+  tcase_add_test(tc_core, test_init_region);
+  tcase_add_test(tc_core, test_heap_growth);
+  tcase_add_test(tc_core, test_trim);
+  tcase_add_test(tc_core, test_mmap_threshold);
 
   suite_add_tcase(s, tc_core);
   return s;
@@ -15,18 +15,24 @@ typedef struct List {
     int Count;
 }List;
 
+/* All nodes have the same size, so they are packed into slabs without a header each */
+static SlabCache *nodeCache = NULL;
+
 void freeList (List* list) {
     Node *currentNode;
     while(list->head != NULL) {
         currentNode = list->head;
         list->head = list->head->next;
-        simple_free(currentNode);
+        simple_slab_free(nodeCache, currentNode);
     }
     simple_free(list);
 }
 
 Node* initNode(int value) {
-    Node* tempNode = (Node*) simple_malloc(sizeof(Node));
+    if (nodeCache == NULL) {
+        nodeCache = simple_slab_create(sizeof(Node));
+    }
+    Node* tempNode = (Node*) simple_slab_alloc(nodeCache);
     tempNode->value = value;
     tempNode->next = NULL;
     tempNode->prev = NULL;
@@ -73,7 +79,7 @@ void deleteFromEnd(Node** head) {
     } else {
         *head = NULL;
     }
-    simple_free(temp);
+    simple_slab_free(nodeCache, temp);
 }
 
 /**
@@ -11,7 +11,9 @@
 
 #include "mm.h"
 
-#define ALLOCATE_SIZE    32*1024*1024                 // 32 MB
+#ifndef ALLOCATE_SIZE
+#define ALLOCATE_SIZE    (32*1024*1024)               // 32 MB, override with -DALLOCATE_SIZE=...
+#endif
 #define SKEW_SIZE        10
 
 static int8_t skew[SKEW_SIZE];                        // Misalignment
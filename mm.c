@@ -6,30 +6,290 @@
  * 
  */
 
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 
 /* Proposed data structure elements */
 
+/*
+ * A header holds the size of its block, including the header, with flags
+ * in the low bits. The next block follows right after, so it is found by
+ * adding the size, and the size is known without looking at other blocks.
+ */
+#ifdef COMPACT_HEADERS
+/*
+ * Compact headers keep the size in 32 bits. Headers are placed 4 bytes
+ * before an 8 byte boundary, so the user block still is 8 byte aligned.
+ * No block can be 4 GB or larger.
+ */
+typedef uint32_t HeaderWord;
+#else
+typedef uint64_t HeaderWord;
+#endif
+
 typedef struct header {
-    struct header * next;     // Bit 0 is used to indicate free block
-    uint64_t user_block[0];   // Standard trick: Empty array to make sure start of user block is aligned
+    HeaderWord size;            // Size including the header. Bit 0 indicates a free block, bit 2 that the previous block is free
+    HeaderWord user_block[0];   // Standard trick: Empty array to make sure start of user block is aligned
 } BlockHeader;
 
-/* Macros to handle the free flag at bit 0 of the next pointer of header pointed at by p */
-#define GET_NEXT(p)    (BlockHeader *)((uintptr_t)(p->next) & ~0x1)    /* Mask out free flag */
-#define SET_NEXT(p,n)  p->next = (BlockHeader *)(((uintptr_t)n & ~0x1) | ((uintptr_t)p->next & 0x1))  /* Preserve free flag */
-#define GET_FREE(p)    (uint8_t) (((uintptr_t)(p->next) & 0x1))   /* Get the free flag */
-#define SET_FREE(p,f)  p->next = (BlockHeader *)(((uintptr_t)GET_NEXT(p)) | ((f) ? 0x1 : 0x0))   /* Set free bit */
-#define SIZE(p)        ((size_t)((uintptr_t)GET_NEXT(p) - (uintptr_t)(p) - sizeof(BlockHeader)))  /* Calculate block size */
-#define MIN_SIZE     (8)   // A block should have at least 8 bytes available for the user
+/* Links of a free block to its neighbours in the size class list. Stored in the user block of free blocks only */
+typedef struct free_links {
+    BlockHeader * fd;         // Next free block in the same size class
+    BlockHeader * bk;         // Previous free block in the same size class
+} FreeLinks;
+
+/*
+ * Links are copied in and out of the user block, which holds data of any
+ * type while the block is in use, so they never alias that data.
+ */
+static inline BlockHeader * get_link(const BlockHeader * p, size_t offset) {
+    BlockHeader * q;
+    memcpy(&q, (const char *) p->user_block + offset, sizeof(q));
+    return q;
+}
+
+static inline void set_link(BlockHeader * p, size_t offset, BlockHeader * q) {
+    memcpy((char *) p->user_block + offset, &q, sizeof(q));
+}
+
+#define FREE_BIT       (0x1)   /* This block is free */
+#define PREV_FREE_BIT  (0x4)   /* The block before this one is free and ends with a footer */
+#define FLAG_BITS      (FREE_BIT | PREV_FREE_BIT)
+
+/*
+ * The header word of an allocated block is read without a lock, by the
+ * thread that owns the block, while the neighbour before it may update the
+ * PREV_FREE_BIT under the arena lock. So every access to it is atomic.
+ * Updates are all made under the arena lock and never race each other.
+ */
+#define HEADER(p)        __atomic_load_n(&(p)->size, __ATOMIC_RELAXED)
+#define SET_HEADER(p,v)  __atomic_store_n(&(p)->size, (HeaderWord) (v), __ATOMIC_RELAXED)
+
+/* Macros to handle the flags in the low bits of the size in the header pointed at by p */
+#define GET_NEXT(p)    ((BlockHeader *)((uintptr_t)(p) + (HEADER(p) & ~FLAG_BITS)))    /* Mask out flags */
+#define SET_NEXT(p,n)  SET_HEADER(p, ((HeaderWord)((uintptr_t)(n) - (uintptr_t)(p)) & ~FLAG_BITS) | (HEADER(p) & FLAG_BITS))  /* Preserve flags */
+#define INIT_NEXT(p,n) SET_HEADER(p, (uintptr_t)(n) - (uintptr_t)(p))    /* Clear flags */
+#define GET_FREE(p)    (uint8_t) (HEADER(p) & FREE_BIT)   /* Get the free flag */
+#define SET_FREE(p,f)  SET_HEADER(p, (HEADER(p) & ~FREE_BIT) | ((f) ? FREE_BIT : 0x0))   /* Set free bit */
+#define SIZE(p)        ((size_t)(HEADER(p) & ~FLAG_BITS) - sizeof(BlockHeader))  /* Size of the user block */
+
+/* Macros to handle the boundary tag of free blocks */
+#define GET_PREV_FREE(p)    (uint8_t) ((HEADER(p) & PREV_FREE_BIT) != 0)   /* Get the previous-free flag */
+#define SET_PREV_FREE(p,f)  SET_HEADER(p, (HEADER(p) & ~PREV_FREE_BIT) | ((f) ? PREV_FREE_BIT : 0x0))
+#define FOOTER_SIZE    sizeof(HeaderWord)
+#define SET_FOOTER(p)  (((HeaderWord *)GET_NEXT(p))[-1] = HEADER(p) & ~FLAG_BITS)   /* Last word of the block, a copy of its size */
+#define PREV(p)        ((BlockHeader *)((uintptr_t)(p) - ((HeaderWord *)(p))[-1]))   /* Header of the previous block, only valid if it is free */
+
+/* Headers are placed so that the user block after them is 8 byte aligned */
+#define HEADER_PAD     ((sizeof(uintptr_t) - sizeof(BlockHeader)) % sizeof(uintptr_t))
+
+/*
+ * Each region of memory ends with a dummy block that is never free. Its
+ * user block holds the address of the first block of the next region of
+ * the arena, so the regions form one circular list of blocks. Its size
+ * is smaller than that of any other block.
+ */
+#define DUMMY_SIZE     (sizeof(BlockHeader) + sizeof(BlockHeader *))
+#define GET_DUMMY_LINK(p)    get_link(p, 0)
+#define SET_DUMMY_LINK(p,q)  set_link(p, 0, q)
+#define IS_DUMMY(p)    (SIZE(p) == sizeof(BlockHeader *) + HEADER_PAD)
+#define WALK_NEXT(p)   (IS_DUMMY(p) ? GET_DUMMY_LINK(p) : GET_NEXT(p))   /* Next block in the list, across regions */
+
+/* Size class links of a free block */
+#define GET_FD(p)      get_link(p, offsetof(FreeLinks, fd))
+#define SET_FD(p,q)    set_link(p, offsetof(FreeLinks, fd), q)
+#define GET_BK(p)      get_link(p, offsetof(FreeLinks, bk))
+#define SET_BK(p,q)    set_link(p, offsetof(FreeLinks, bk), q)
+#define MIN_SIZE     (sizeof(FreeLinks) + FOOTER_SIZE)   // A block must be able to hold its links and footer once freed
+
+/*
+ * Two level segregated free lists: each power of two range of sizes
+ * [2^f, 2^(f+1)) is split into SL_COUNT equal classes, and a bitmap per
+ * level tells which classes hold free blocks. Class index i is f * SL_COUNT
+ * plus the class within the range.
+ */
+#define SL_LOG2      (4)
+#define SL_COUNT     (1 << SL_LOG2)
+#define FL_COUNT     (64)
+#define NUM_BINS     (FL_COUNT * SL_COUNT)
+
+/* Blocks of the size class a good fit looks at before settling */
+#define GOOD_FIT_PROBES  (8)
+
+/* Remote frees released per arena by one allocation under the real-time policy, see drain_remote_frees */
+#define REMOTE_DRAIN_MAX  (4)
+
+/* Per-thread cache of small blocks: one list per exact size, each holding at most TCACHE_FILL blocks */
+#define TCACHE_MAX_SIZE  (512)
+#define TCACHE_BINS      ((TCACHE_MAX_SIZE - MIN_SIZE) / 8 + 1)
+#define TCACHE_FILL      (8)
+#define TCACHE_INDEX(s)  (((s) - MIN_SIZE) / 8)
+
+/*
+ * Blocks in a thread cache stay marked as allocated in the block list, so
+ * they are never merged while cached. They are linked through their fd link,
+ * and their bk link is set to TCACHE_KEY to catch double frees.
+ */
+typedef struct tcache {
+    BlockHeader * entries[TCACHE_BINS];
+    uint8_t counts[TCACHE_BINS];
+    int registered;           // Set when the thread exit destructor is installed
+} TCache;
+
+#define TCACHE_KEY   ((BlockHeader *) &tcache)
+
+/* Public calls counted for simple_mallinfo */
+enum { CALL_MALLOC, CALL_FREE, CALL_CALLOC, CALL_REALLOC, CALL_ALIGNED_ALLOC, NUM_CALLS };
+
+/* Number of independent arenas the managed memory is split into, each with its own lock */
+#ifndef NUM_ARENAS
+#define NUM_ARENAS   (4)
+#endif
+
+/*
+ * An arena manages one or more regions of memory as a circular list of
+ * blocks. Each region ends with a dummy block that is never free and links
+ * to the first block of the next region. Threads are assigned to arenas
+ * round robin, so threads in different arenas never share a lock.
+ *
+ * Blocks freed by threads assigned to another arena are not released under
+ * the lock. They are pushed on remote_frees, a lock-free stack linked
+ * through the fd link, which the next allocation in the arena empties.
+ *
+ * The default memory starts out zeroed. Everything from zero_from up to
+ * zero_end, the dummy block of the zeroed region, has never been part of a
+ * user block, so it is still zero apart from allocator metadata: at most a
+ * header and free links in its first ZERO_SKIP bytes and the footer of the
+ * last free block.
+ *
+ * The size and number of the free blocks in the index are counted as they
+ * go in and out, so statistics never need to walk the blocks.
+ */
+typedef struct arena {
+    pthread_mutex_t lock;              // Protects everything below but remote_frees
+    BlockHeader * first;
+    BlockHeader * current;
+    BlockHeader * last;
+    BlockHeader * bins[NUM_BINS];      // Head of the free list of each size class
+    uint64_t fl_map;                   // Bit f is set when any class of range f is not empty
+    uint32_t sl_map[FL_COUNT];         // Bit s of sl_map[f] is set when bins[f * SL_COUNT + s] is not empty
+    BlockHeader * tree;                // Root of the size ordered tree of free blocks, for best fit
+    BlockHeader * remote_frees;        // Blocks freed from other arenas, only accessed atomically
+    uintptr_t zero_from;               // Start of the memory never handed out
+    uintptr_t zero_end;                // End of the memory known to be zero
+    size_t free_bytes;                 // Total size of the free blocks in the index
+    size_t free_blocks;                // Number of free blocks in the index
+    size_t calls[NUM_CALLS];           // Public calls by threads of this arena, only accessed atomically
+} Arena;
+
+#define ZERO_SKIP    (sizeof(BlockHeader) + sizeof(FreeLinks))
+
+/*
+ * Every region is recorded in a table, used to find the arena of a block
+ * when it is freed. Entries are only ever appended and published by
+ * incrementing num_regions, so the table is read without a lock. The end
+ * of a region only grows, when the heap grows right behind it.
+ */
+typedef struct region {
+    uintptr_t start;
+    uintptr_t end;
+    Arena * arena;
+} Region;
+
+#define MAX_REGIONS  (64)
+
+/*
+ * With a reserve the heap grows on demand: a range of address space is
+ * mapped without access up front, and chunks of it are made accessible
+ * for an arena when no arena can serve a request.
+ */
+#define GROW_CHUNK   (1024 * 1024)
+
+/*
+ * Requests of at least mmap_threshold bytes get a mapping of their own, so
+ * they neither fragment the arenas nor keep memory after being freed. A
+ * threshold of 0 turns this off.
+ */
+#define MMAP_THRESHOLD  (4 * 1024 * 1024)
+
+/*
+ * The memory can be backed by huge pages, so walking the blocks and using
+ * them takes fewer TLB entries. Transparent huge pages are requested with
+ * madvise. Explicit ones are taken from the hugetlbfs pool for the default
+ * memory, falling back to transparent ones if the pool is empty.
+ */
+#define HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+typedef enum {
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_THP,        // MM_HUGE_PAGES=thp
+    HUGE_PAGES_HUGETLB,    // MM_HUGE_PAGES=hugetlb
+} HugePages;
+
+/*
+ * When turned on, the latency of every simple_malloc and simple_free is
+ * counted in a histogram per call and size class of the request, classes
+ * growing by a factor of 8. Latencies are in ticks of the time stamp
+ * counter, or nanoseconds where there is none. Buckets are log-linear:
+ * each power of two range is split into LAT_SUB buckets, so a bucket is at
+ * most an eighth as wide as the values in it. Counts are atomic adds,
+ * without any lock.
+ */
+#define LAT_SUB_LOG2   (3)
+#define LAT_SUB        (1 << LAT_SUB_LOG2)
+#define LAT_BUCKETS    ((65 - LAT_SUB_LOG2) * LAT_SUB)   // Enough for any 64 bit latency
+#define LAT_CALLS      (2)
+
+/* Larger requests are refused up front, so size computations cannot overflow */
+#ifdef COMPACT_HEADERS
+#define MAX_REQUEST  ((size_t) INT32_MAX)
+#define MAX_REGION   ((size_t) UINT32_MAX & ~(size_t) 0x7)   // Largest distance a header can hold
+#else
+#define MAX_REQUEST  (SIZE_MAX / 4)
+#define MAX_REGION   (SIZE_MAX & ~(size_t) 0x7)
+#endif
+
+/* Smallest region that holds a block and the dummy block */
+#define MIN_REGION   (HEADER_PAD + sizeof(BlockHeader) + MIN_SIZE + DUMMY_SIZE)
 
 extern const uintptr_t memory_start, memory_end;
 
-static BlockHeader * first = NULL;
-static BlockHeader * current = NULL;
-static BlockHeader *last = NULL;
+static PlacementPolicy policy = MM_NEXT_FIT;   // Only changed with all arena locks held, read atomically without one
+static Arena arenas[NUM_ARENAS];
+static Region regions[MAX_REGIONS];
+static unsigned int num_regions = 0;   // Entries of regions in use, only accessed atomically
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;   // Serializes adding regions and growing
+static uintptr_t reserve_next = 0;     // Start of the reserve not handed out yet
+static uintptr_t reserve_end = 0;
+static size_t mmap_threshold = MMAP_THRESHOLD;   // Only accessed atomically
+static uintptr_t page_size = 4096;
+static HugePages huge_pages = HUGE_PAGES_OFF;
+static int initialized = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static unsigned int next_arena = 0;    // Arena handed to the next new thread
+static size_t used_bytes = 0;          // Total size of the allocated blocks, only accessed atomically
+static size_t used_blocks = 0;         // Number of allocated blocks, only accessed atomically
+static size_t peak_bytes = 0;          // Largest value used_bytes has had, only accessed atomically
+static int latency_on = 0;             // Set while latencies are recorded, only accessed atomically
+static uint64_t latencies[LAT_CALLS][MM_LATENCY_CLASSES][LAT_BUCKETS];   // Only accessed atomically
+
+static _Thread_local Arena * thread_arena = NULL;
+static _Thread_local TCache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
 
 /**
  * @name    align_up
@@ -43,117 +303,1522 @@ static inline size_t align_up(size_t x, size_t align) {
 return (x + (align - 1)) & ~(align - 1);
 }
 
-int coalesceNext(BlockHeader * curr) {
-    BlockHeader * next = GET_NEXT(curr);
-    if (GET_FREE(next)&& GET_FREE(curr)) {
-        SET_NEXT(curr, GET_NEXT(next));
-        return 1;
+/**
+ * @name    block_size
+ * @brief   Returns the size of the block used for a request of size bytes.
+ *
+ * The block is padded so the header after it is placed like every header,
+ * and is at least MIN_SIZE bytes.
+ */
+static inline size_t block_size(size_t size) {
+    size = align_up(size + sizeof(BlockHeader), sizeof(uintptr_t)) - sizeof(BlockHeader);
+    return (size < MIN_SIZE) ? MIN_SIZE : size;
+}
+
+/**
+ * @name    bin_index
+ * @brief   Returns the size class of a block: its power of two range and the class within it.
+ *
+ * The range is the position of the highest set bit of size, the class the
+ * SL_LOG2 bits below it. Sizes are at least MIN_SIZE, so these bits exist.
+ */
+static inline int bin_index(size_t size) {
+    int f = 63 - __builtin_clzll((unsigned long long) size);
+    return (f << SL_LOG2) + (int) ((size >> (f - SL_LOG2)) & (SL_COUNT - 1));
+}
+
+/**
+ * @name    bin_search
+ * @brief   Returns the first non-empty size class at or above i, found with one lookup per level.
+ * @retval  Its index, or -1 if all of them are empty.
+ */
+static inline int bin_search(Arena * a, int i) {
+    int f = i >> SL_LOG2;
+    uint32_t sl = a->sl_map[f] & (~(uint32_t) 0 << (i & (SL_COUNT - 1)));
+    uint64_t fl;
+
+    if (sl == 0) {
+        fl = (f + 1 < FL_COUNT) ? a->fl_map & (~(uint64_t) 0 << (f + 1)) : 0;
+        if (fl == 0) return -1;
+        f = __builtin_ctzll(fl);
+        sl = a->sl_map[f];
     }
-    return 0;
+    return (f << SL_LOG2) + __builtin_ctz(sl);
 }
 
-void simple_init() {
-    uintptr_t aligned_memory_start = memory_start + (8 - (memory_start % 8));
-    uintptr_t aligned_memory_end   = memory_end - (memory_end % 8);
-    if (first == NULL) {
-        if (aligned_memory_start + 2 * sizeof(BlockHeader) + MIN_SIZE <= aligned_memory_end) {
-            first = (BlockHeader *) aligned_memory_start;
-            last = (BlockHeader *) aligned_memory_end-sizeof(BlockHeader);
-            SET_FREE(first, 1);
-            SET_NEXT(first, last);
-            SET_NEXT(last, first);
-            SET_FREE(last, 0);
-            current = first;
+/**
+ * @name    bin_insert
+ * @brief   Pushes the free block p on the front of the list of its size class.
+ */
+static void bin_insert(Arena * a, BlockHeader * p) {
+    int i = bin_index(SIZE(p));
+    SET_BK(p, NULL);
+    SET_FD(p, a->bins[i]);
+    if (a->bins[i] != NULL) {
+        SET_BK(a->bins[i], p);
+    }
+    a->bins[i] = p;
+    a->sl_map[i >> SL_LOG2] |= (uint32_t) 1 << (i & (SL_COUNT - 1));
+    a->fl_map |= (uint64_t) 1 << (i >> SL_LOG2);
+}
+
+/**
+ * @name    bin_remove
+ * @brief   Unlinks the free block p from the list of its size class.
+ *
+ * Must be called before the size of p is changed.
+ */
+static void bin_remove(Arena * a, BlockHeader * p) {
+    int i = bin_index(SIZE(p));
+    BlockHeader * fd = GET_FD(p);
+    BlockHeader * bk = GET_BK(p);
+    if (bk != NULL) {
+        SET_FD(bk, fd);
+    } else {
+        a->bins[i] = fd;
+        if (fd == NULL) {
+            a->sl_map[i >> SL_LOG2] &= ~((uint32_t) 1 << (i & (SL_COUNT - 1)));
+            if (a->sl_map[i >> SL_LOG2] == 0) a->fl_map &= ~((uint64_t) 1 << (i >> SL_LOG2));
         }
     }
+    if (fd != NULL) {
+        SET_BK(fd, bk);
+    }
 }
 
-void* simple_malloc(size_t size) {
-    if (first == NULL) {
-        //printf("simple_init() \n");
-        simple_init();
-        //printf("done \n");
-        if (first == NULL) return NULL;
-    }
-//Pad the requested size to a multiple of 8 bytes
-    size_t aligned_size = align_up(size, sizeof(uintptr_t));
-    BlockHeader * search_start = current;
-    int allocated = 0;
-    //current = first;
-    do { // Search for a free block
-        if (GET_FREE(current)) { //the current block is free
-            if (SIZE(current) >= aligned_size) { // The current block is large enough to contain the requested block
-                //printf("(SIZE(current) >= aligned_size) == true \n");
-                if (SIZE(current) - aligned_size < sizeof(BlockHeader) + MIN_SIZE) {
-                    //The current block is large enough to contain only the requested block
-                    //printf("SET_FREE) \n");
-                    SET_FREE(current, 0);
-                    allocated = 1;
-                    //printf("Done \n");
-                } else {
-                    //The current block is large enough to contain the requested block and a new free block
-                    BlockHeader * new_block = (BlockHeader *)((uintptr_t)current + sizeof(BlockHeader) + aligned_size);
-                    BlockHeader * next = GET_NEXT(current);
-                    SET_FREE(new_block, 1);
-                    if (GET_FREE(next)){//If next is free, coalesce new block with next
-                        SET_NEXT(new_block, GET_NEXT(next));
-                    }
-                    else{ //If next is not free, set next as next of new block
-                        SET_NEXT(new_block, next);
-                    }
-                    SET_NEXT(current, new_block);
-                    SET_FREE(current, 0);
-                    allocated = 1;
-                }
-            } else { //The current block is not large enough to contain the requested block
-                //printf("Assessing next block \n");
-                BlockHeader * next = (GET_NEXT(current));
-                // Check if the next block is free and the combined block is large enough
-                if ((next != NULL) && (GET_FREE(next)) && ((SIZE(current) + SIZE(next) + sizeof(BlockHeader)) >= aligned_size)) {
-                    allocated = coalesceNext(current);
-                    if (allocated) {
-                        SET_FREE(current, 0);
-                  //      printf("Successfully coalesced 2 blocks\n");
-                    }
-                    else {
-                    //    printf("Failed to coalesce 2 blocks\n");
-                        return NULL;
-                    }
-                }
-            }
-            // If a block has been allocated, check if it can be split further
-            if (allocated) {
-                void *currAdd = (void *)((uintptr_t)current + sizeof(BlockHeader));
-                current = GET_NEXT(current);
-                if ((uintptr_t)current > memory_end) {
-                    return NULL;
-                }
-                if (GET_NEXT(current)==NULL){
-                    SET_NEXT(current, last);
-                }
+/**
+ * @name    class_find
+ * @brief   Finds a free block of at least size bytes in constant time.
+ *
+ * The size is rounded up to the start of the next class, so the head of
+ * any class found from there fits. A fitting block in the class of the
+ * request itself is missed unless size is the start of that class.
+ *
+ * @retval  A free block still linked in its size class, or NULL if none is found.
+ */
+static BlockHeader * class_find(Arena * a, size_t size) {
+    int f = 63 - __builtin_clzll((unsigned long long) size);
+    int i = bin_search(a, bin_index(size + ((size_t) 1 << (f - SL_LOG2)) - 1));
 
-               // printf("Returning address \n");
-                return currAdd; // Return the address of the allocated block
-            }
+    return (i >= 0) ? a->bins[i] : NULL;
+}
+
+/**
+ * @name    bin_find
+ * @brief   Finds a free block of at least size bytes in the size class lists.
+ *
+ * Usually found in constant time by class_find. Only when there is none,
+ * the class of the request itself, which may hold blocks both smaller and
+ * larger than size, is searched first-fit.
+ *
+ * @retval  A free block still linked in its size class, or NULL if none fits.
+ */
+static BlockHeader * bin_find(Arena * a, size_t size) {
+    BlockHeader * p = class_find(a, size);
+
+    if (p != NULL) return p;
+    for (p = a->bins[bin_index(size)]; p != NULL; p = GET_FD(p)) {
+        if (SIZE(p) >= size) return p;
+    }
+    return NULL;
+}
+
+/*
+ * For best fit, free blocks are instead kept in a treap ordered by size and
+ * then address. The priority of a node is a hash of its address, which keeps
+ * the expected depth logarithmic without storing anything but the two child
+ * links, so every free block can be a node.
+ */
+#define TREE_LEFT(p)         GET_FD(p)
+#define TREE_RIGHT(p)        GET_BK(p)
+#define SET_TREE_LEFT(p,q)   SET_FD(p, q)
+#define SET_TREE_RIGHT(p,q)  SET_BK(p, q)
+
+static inline uint32_t tree_priority(BlockHeader * p) {
+    return (uint32_t) (((uint64_t) (uintptr_t) p * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static inline int tree_less(BlockHeader * p, BlockHeader * q) {
+    return SIZE(p) < SIZE(q) || (SIZE(p) == SIZE(q) && p < q);
+}
+
+/**
+ * @name    tree_split
+ * @brief   Splits the tree t into the nodes ordered before p and those after it.
+ */
+static void tree_split(BlockHeader * t, BlockHeader * p, BlockHeader ** left, BlockHeader ** right) {
+    BlockHeader * sub;
+
+    if (t == NULL) {
+        *left = *right = NULL;
+    } else if (tree_less(t, p)) {
+        tree_split(TREE_RIGHT(t), p, &sub, right);
+        SET_TREE_RIGHT(t, sub);
+        *left = t;
+    } else {
+        tree_split(TREE_LEFT(t), p, left, &sub);
+        SET_TREE_LEFT(t, sub);
+        *right = t;
+    }
+}
+
+/**
+ * @name    tree_join
+ * @brief   Joins two trees where all nodes of left are ordered before those of right.
+ */
+static BlockHeader * tree_join(BlockHeader * left, BlockHeader * right) {
+    if (left == NULL) return right;
+    if (right == NULL) return left;
+    if (tree_priority(left) > tree_priority(right)) {
+        SET_TREE_RIGHT(left, tree_join(TREE_RIGHT(left), right));
+        return left;
+    }
+    SET_TREE_LEFT(right, tree_join(left, TREE_LEFT(right)));
+    return right;
+}
+
+/**
+ * @name    tree_insert
+ * @brief   Inserts the free block p in the tree t.
+ * @retval  The new root of the tree.
+ */
+static BlockHeader * tree_insert(BlockHeader * t, BlockHeader * p) {
+    BlockHeader * left, * right;
+
+    if (t == NULL || tree_priority(p) > tree_priority(t)) {
+        tree_split(t, p, &left, &right);
+        SET_TREE_LEFT(p, left);
+        SET_TREE_RIGHT(p, right);
+        return p;
+    }
+    if (tree_less(p, t)) {
+        SET_TREE_LEFT(t, tree_insert(TREE_LEFT(t), p));
+    } else {
+        SET_TREE_RIGHT(t, tree_insert(TREE_RIGHT(t), p));
+    }
+    return t;
+}
+
+/**
+ * @name    tree_remove
+ * @brief   Removes the free block p from the tree t. Must be called before the size of p is changed.
+ * @retval  The new root of the tree.
+ */
+static BlockHeader * tree_remove(BlockHeader * t, BlockHeader * p) {
+    if (t == p) return tree_join(TREE_LEFT(p), TREE_RIGHT(p));
+    if (tree_less(p, t)) {
+        SET_TREE_LEFT(t, tree_remove(TREE_LEFT(t), p));
+    } else {
+        SET_TREE_RIGHT(t, tree_remove(TREE_RIGHT(t), p));
+    }
+    return t;
+}
+
+/**
+ * @name    tree_find
+ * @brief   Finds the smallest free block of at least size bytes, the lowest one if there are several.
+ */
+static BlockHeader * tree_find(BlockHeader * t, size_t size) {
+    BlockHeader * best = NULL;
+    while (t != NULL) {
+        if (SIZE(t) >= size) {
+            best = t;
+            t = TREE_LEFT(t);
+        } else {
+            t = TREE_RIGHT(t);
+        }
+    }
+    return best;
+}
+
+/**
+ * @name    list_find
+ * @brief   Finds the first free block of at least size bytes in list order by walking the block list.
+ *
+ * The list runs by address within a region, but through the regions of the
+ * arena in the order they were added, so the block need not be the lowest.
+ */
+static BlockHeader * list_find(Arena * a, size_t size) {
+    BlockHeader * p = a->first;
+    if (p == NULL) return NULL;
+    do {
+        if (GET_FREE(p) && SIZE(p) >= size) return p;
+        p = WALK_NEXT(p);
+    } while (p != a->first);
+    return NULL;
+}
+
+/**
+ * @name    good_find
+ * @brief   Finds a close fit by looking at only the first GOOD_FIT_PROBES blocks of the size class.
+ *
+ * The smallest fitting block among them is taken. If none fits, a block from
+ * a higher class is, and the rest of the class is only searched when there
+ * is none.
+ */
+static BlockHeader * good_find(Arena * a, size_t size) {
+    int i = bin_index(size);
+    int n = 0;
+    BlockHeader * p;
+    BlockHeader * best = NULL;
+
+    for (p = a->bins[i]; p != NULL && n < GOOD_FIT_PROBES; p = GET_FD(p), n++) {
+        if (SIZE(p) >= size && (best == NULL || SIZE(p) < SIZE(best))) {
+            best = p;
+            if (SIZE(p) == size) break;
         }
-        current = GET_NEXT(current);
-    } while (current != search_start);
+    }
+    if (best != NULL) return best;
+    i = (i + 1 < NUM_BINS) ? bin_search(a, i + 1) : -1;
+    if (i >= 0) return a->bins[i];
+    return (p != NULL) ? bin_find(a, size) : NULL;
+}
+
+static void tree_add(Arena * a, BlockHeader * p) {
+    a->tree = tree_insert(a->tree, p);
+}
+
+static void tree_del(Arena * a, BlockHeader * p) {
+    a->tree = tree_remove(a->tree, p);
+}
+
+static BlockHeader * tree_fit(Arena * a, size_t size) {
+    return tree_find(a->tree, size);
+}
+
+/*
+ * A placement policy decides which free block serves a request. It brings
+ * its own index of the free blocks, all sharing the block list and headers,
+ * so switching policy only means rebuilding the index.
+ */
+typedef struct placement {
+    const char * name;                                  // As accepted in the MM_POLICY environment variable
+    void (*insert)(Arena * a, BlockHeader * p);         // Add a free block to the index
+    void (*remove)(Arena * a, BlockHeader * p);         // Remove a free block, before its size changes
+    BlockHeader * (*find)(Arena * a, size_t size);      // Find a fitting free block, still in the index
+    int next_fit;                                       // Try the block after the previous allocation first
+} Placement;
+
+static const Placement placements[] = {
+    [MM_NEXT_FIT]  = { "next",     bin_insert, bin_remove, bin_find,   1 },
+    [MM_BEST_FIT]  = { "best",     tree_add,   tree_del,   tree_fit,   0 },
+    [MM_FIRST_FIT] = { "first",    bin_insert, bin_remove, list_find,  0 },
+    [MM_GOOD_FIT]  = { "good",     bin_insert, bin_remove, good_find,  0 },
+    [MM_REALTIME]  = { "realtime", bin_insert, bin_remove, class_find, 0 },
+};
+
+#define NUM_POLICIES  (sizeof(placements) / sizeof(placements[0]))
+
+/**
+ * @name    free_insert
+ * @brief   Adds the free block p to the index of free blocks used by the placement policy.
+ */
+static inline void free_insert(Arena * a, BlockHeader * p) {
+    placements[policy].insert(a, p);
+    a->free_bytes += SIZE(p);
+    a->free_blocks++;
+}
+
+/**
+ * @name    free_remove
+ * @brief   Takes the free block p out of the index of free blocks. Must be called before its size is changed.
+ */
+static inline void free_remove(Arena * a, BlockHeader * p) {
+    placements[policy].remove(a, p);
+    a->free_bytes -= SIZE(p);
+    a->free_blocks--;
+}
+
+/**
+ * @name    find_fit
+ * @brief   Finds a free block of at least size bytes according to the placement policy.
+ * @retval  A free block still in the index, or NULL if none fits.
+ */
+static inline BlockHeader * find_fit(Arena * a, size_t size) {
+    return placements[policy].find(a, size);
+}
+
+/**
+ * @name    realtime
+ * @brief   Tells whether the real-time policy is in use, which rules out any step of unbounded cost.
+ */
+static inline int realtime(void) {
+    return __atomic_load_n(&policy, __ATOMIC_RELAXED) == MM_REALTIME;
+}
+
+/**
+ * @name    count_used
+ * @brief   Adds bytes, which may be negative, and blocks to the allocated memory, keeping track of its peak.
+ */
+static void count_used(ptrdiff_t bytes, int blocks) {
+    size_t used = __atomic_add_fetch(&used_bytes, (size_t) bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&used_blocks, (size_t) (ptrdiff_t) blocks, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&peak_bytes, &peak, used, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * @name    set_free
+ * @brief   Marks p free, writes its footer and tells the next block about it.
+ */
+static inline void set_free(BlockHeader * p) {
+    BlockHeader * next = GET_NEXT(p);
+    SET_FREE(p, 1);
+    SET_FOOTER(p);
+    SET_PREV_FREE(next, 1);
+}
+
+/**
+ * @name    set_used
+ * @brief   Marks p allocated and clears the previous-free flag of the next block.
+ */
+static inline void set_used(BlockHeader * p) {
+    BlockHeader * next = GET_NEXT(p);
+    SET_FREE(p, 0);
+    SET_PREV_FREE(next, 0);
+}
+
+/**
+ * @name    coalesce
+ * @brief   Merges the block p, which is not in any size class, with its free neighbours.
+ *
+ * The neighbours are taken out of their size classes. Both are found in
+ * constant time: the next block through the size of p and the previous
+ * one through the footer it leaves when free. The merged block is marked
+ * free but it is up to the caller to put it in its size class.
+ *
+ * @retval  The header of the merged block.
+ */
+static BlockHeader * coalesce(Arena * a, BlockHeader * p) {
+    BlockHeader * next = GET_NEXT(p);
+
+    if (GET_FREE(next)) {
+        free_remove(a, next);
+        SET_NEXT(p, GET_NEXT(next));
+        if (a->current == next) a->current = p;
+    }
+    if (GET_PREV_FREE(p)) {
+        BlockHeader * prev = PREV(p);
+        free_remove(a, prev);
+        SET_NEXT(prev, GET_NEXT(p));
+        if (a->current == p) a->current = prev;
+        p = prev;
+    }
+    set_free(p);
+    return p;
+}
+
+/**
+ * @name    split
+ * @brief   Shrinks the block p to size bytes if the tail can hold a block of its own.
+ *
+ * The tail becomes a new free block, which is merged with its successor if
+ * that one is free and then put in its size class.
+ */
+static void split(Arena * a, BlockHeader * p, size_t size) {
+    if (SIZE(p) - size >= sizeof(BlockHeader) + MIN_SIZE) {
+        BlockHeader * new_block = (BlockHeader *)((uintptr_t)p + sizeof(BlockHeader) + size);
+        INIT_NEXT(new_block, GET_NEXT(p));
+        SET_NEXT(p, new_block);
+        free_insert(a, coalesce(a, new_block));
+    }
+}
 
-/* None found */
+/**
+ * @name    region_of
+ * @brief   Returns the region containing the address p, or NULL if it is not managed.
+ */
+static Region * region_of(const void * p) {
+    unsigned int n = __atomic_load_n(&num_regions, __ATOMIC_ACQUIRE);
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        if ((uintptr_t) p >= regions[i].start && (uintptr_t) p < __atomic_load_n(&regions[i].end, __ATOMIC_ACQUIRE)) {
+            return &regions[i];
+        }
+    }
     return NULL;
 }
 
-void simple_free(void * ptr) {
-    //printf("Simple free called\n");
-    if (ptr == NULL) return;
+/**
+ * @name    arena_of
+ * @brief   Returns the arena whose memory contains the block p.
+ */
+static inline Arena * arena_of(BlockHeader * p) {
+    return region_of(p)->arena;
+}
 
-    BlockHeader * block = (BlockHeader *)((uintptr_t)ptr - sizeof(BlockHeader));
-    if (GET_FREE(block)) {
-        return; //block is already free
+/**
+ * @name    region_add
+ * @brief   Hands the memory from start to end to the arena a. Called with a->lock held, if set up.
+ *
+ * The memory becomes a single free block followed by a dummy block, which
+ * are linked in after the last region of the arena. It must be at least
+ * MIN_REGION and at most MAX_REGION bytes.
+ *
+ * @param   int zeroed Set if the memory is known to be all zero.
+ * @retval  0 if ok, -1 if the memory overlaps a managed region or the table is full.
+ */
+static int region_add(Arena * a, uintptr_t start, uintptr_t end, int zeroed) {
+    BlockHeader * first = (BlockHeader *) (start + HEADER_PAD);
+    BlockHeader * last = (BlockHeader *) (end - DUMMY_SIZE);
+    unsigned int i;
+
+    pthread_mutex_lock(&region_lock);
+    for (i = 0; i < num_regions; i++) {
+        if (start < regions[i].end && regions[i].start < end) break;
+    }
+    if (i < num_regions || num_regions == MAX_REGIONS) {
+        pthread_mutex_unlock(&region_lock);
+        return -1;
+    }
+    regions[i].start = start;
+    regions[i].end = end;
+    regions[i].arena = a;
+    __atomic_store_n(&num_regions, i + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&region_lock);
+
+    INIT_NEXT(first, last);
+    INIT_NEXT(last, end + HEADER_PAD);
+    if (a->first == NULL) {
+        a->first = first;
+        a->current = first;
+    } else {
+        SET_DUMMY_LINK(a->last, first);
+    }
+    SET_DUMMY_LINK(last, a->first);
+    a->last = last;
+    set_free(first);
+    free_insert(a, first);
+
+    if (zeroed) {
+        a->zero_from = (uintptr_t) first;
+        a->zero_end = (uintptr_t) last;
+    }
+    return 0;
+}
+
+/**
+ * @name    parse_size
+ * @brief   Reads a size in bytes with an optional K, M or G suffix into *size.
+ *
+ * *size is only changed if all of the text is a size that fits in a size_t.
+ *
+ * @retval  0 if ok, -1 if the text is not a size or the size is too large.
+ */
+static int parse_size(const char * text, size_t * size) {
+    char * end;
+    unsigned long long n;
+    int shift = 0;
+
+    if (*text < '0' || *text > '9') return -1;   // strtoull would accept blanks and a sign
+    errno = 0;
+    n = strtoull(text, &end, 10);
+    if (errno != 0) return -1;
+
+    switch (*end) {
+        case 'G': case 'g': shift += 10; /* fall through */
+        case 'M': case 'm': shift += 10; /* fall through */
+        case 'K': case 'k': shift += 10; end++; break;
+    }
+    if (*end != '\0' || n > (SIZE_MAX >> shift)) return -1;
+    *size = (size_t) n << shift;
+    return 0;
+}
+
+/**
+ * @name    advise_huge
+ * @brief   Asks for transparent huge pages for the whole huge pages from start to start + len, if enabled.
+ */
+static void advise_huge(uintptr_t start, size_t len) {
+#ifdef MADV_HUGEPAGE
+    uintptr_t from = align_up(start, HUGE_PAGE_SIZE);
+    uintptr_t to = (start + len) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1);
+
+    if (huge_pages != HUGE_PAGES_OFF && to > from) {
+        madvise((void *) from, to - from, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+/**
+ * @name    map_hugetlb
+ * @brief   Maps len bytes of explicit huge pages if enabled.
+ * @retval  The start of the mapping, or 0 if not enabled or the pool is too small.
+ */
+static uintptr_t map_hugetlb(size_t len) {
+#ifdef MAP_HUGETLB
+    void * base;
+
+    if (huge_pages != HUGE_PAGES_HUGETLB || len == 0) return 0;
+    base = mmap(NULL, align_up(len, HUGE_PAGE_SIZE), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED) return (uintptr_t) base;
+#endif
+    return 0;
+}
+
+/**
+ * @name    reserve
+ * @brief   Reserves len bytes of address space for the heap to grow into.
+ *
+ * The reserve replaces any remainder of an earlier one, which is unmapped.
+ *
+ * @retval  0 if ok, -1 if the address space could not be mapped.
+ */
+static int reserve(size_t len) {
+    void * base;
+
+    len = align_up(len, GROW_CHUNK);
+    if (len == 0) return -1;
+    base = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return -1;
+    advise_huge((uintptr_t) base, len);
+
+    pthread_mutex_lock(&region_lock);
+    if (reserve_next < reserve_end) {
+        munmap((void *) reserve_next, reserve_end - reserve_next);
     }
-    SET_FREE(block, 1);
+    reserve_next = (uintptr_t) base;
+    reserve_end = (uintptr_t) base + len;
+    pthread_mutex_unlock(&region_lock);
+    return 0;
 }
 
+void simple_init() {
+    uintptr_t start = memory_start;
+    size_t size = memory_end - memory_start;
+    size_t wanted = size, threshold, len;
+    uintptr_t span, skip, mapped;
+    const char * env = getenv("MM_POLICY");
+    unsigned int i;
+
+    // The placement policy can be chosen per run without rebuilding
+    for (i = 0; env != NULL && i < NUM_POLICIES; i++) {
+        if (strcmp(env, placements[i].name) == 0) policy = (PlacementPolicy) i;
+    }
+
+    page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    // Values that are not sizes are ignored, keeping the defaults
+    env = getenv("MM_MMAP_THRESHOLD");
+    if (env != NULL && parse_size(env, &threshold) == 0) {
+        simple_set_mmap_threshold(threshold);
+    }
+
+    env = getenv("MM_LATENCY");
+    if (env != NULL && strcmp(env, "1") == 0) simple_latency_enable(1);
+
+    env = getenv("MM_TRACE");
+    if (env != NULL) simple_trace_start(env);
+
+    env = getenv("MM_HUGE_PAGES");
+    if (env != NULL && strcmp(env, "thp") == 0) huge_pages = HUGE_PAGES_THP;
+    if (env != NULL && strcmp(env, "hugetlb") == 0) huge_pages = HUGE_PAGES_HUGETLB;
+
+    // The heap can grow into a reserve, which is best combined with a small or no default memory
+    env = getenv("MM_HEAP_RESERVE");
+    if (env != NULL && parse_size(env, &len) == 0) {
+        reserve(len);
+    }
+
+    // So can the size of the default memory, which is mapped if larger than the built-in one or of explicit huge pages
+    env = getenv("MM_HEAP_SIZE");
+    if (env != NULL) parse_size(env, &wanted);
+    mapped = map_hugetlb(wanted);
+    if (mapped != 0) {
+        start = mapped;
+        size = wanted;
+    } else {
+        if (wanted <= size) {
+            size = wanted;
+        } else {
+            void * base = mmap(NULL, wanted, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base != MAP_FAILED) {
+                start = (uintptr_t) base;
+                size = wanted;
+            }
+        }
+        advise_huge(start, size);
+    }
+
+    // Memory too small to even reach the first aligned address leaves the arenas empty
+    skip = align_up(start, 8) - start;
+    span = (size > skip) ? (size - skip) / NUM_ARENAS & ~(uintptr_t) 0x7 : 0;
+    if (span > MAX_REGION) span = MAX_REGION;
+    start += skip;
+    for (i = 0; i < NUM_ARENAS; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        if (span >= MIN_REGION) {
+            region_add(&arenas[i], start + i * span, start + (i + 1) * span, 1);
+        }
+    }
+    initialized = 1;
+}
+
+/**
+ * @name    my_arena
+ * @brief   Returns the arena of the calling thread, assigning one on first use.
+ */
+static Arena * my_arena(void) {
+    pthread_once(&init_once, simple_init);
+    if (thread_arena == NULL) {
+        thread_arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % NUM_ARENAS];
+    }
+    return thread_arena;
+}
+
+int simple_init_region(void * base, size_t len) {
+    uintptr_t start = align_up((uintptr_t) base, 8);
+    uintptr_t end = ((uintptr_t) base + len) & ~(uintptr_t) 0x7;
+    Arena * a;
+    int ret;
+
+    if ((uintptr_t) base + len < (uintptr_t) base || end < start + MIN_REGION || end - start > MAX_REGION) return -1;
+
+    a = my_arena();
+    pthread_mutex_lock(&a->lock);
+    ret = region_add(a, start, end, 0);
+    pthread_mutex_unlock(&a->lock);
+    return ret;
+}
+
+int simple_reserve(size_t len) {
+    pthread_once(&init_once, simple_init);
+    return reserve(len);
+}
+
+/**
+ * @name    note_touched
+ * @brief   Moves zero_from of a past the allocated block, which is now handed out.
+ *
+ * @param   size_t * dirty If not NULL, set to the number of leading bytes of the
+ *                         block that were already touched, see block_alloc.
+ */
+static inline void note_touched(Arena * a, BlockHeader * block, size_t * dirty) {
+    uintptr_t start = (uintptr_t) block->user_block;
+    uintptr_t end = (uintptr_t) GET_NEXT(block);
+    uintptr_t clean = a->zero_from + ZERO_SKIP;
+
+    if (start >= a->zero_end) {   // Not in the zeroed region
+        if (dirty != NULL) *dirty = end - start;
+        return;
+    }
+    if (dirty != NULL) {
+        *dirty = (clean <= start) ? 0 : ((clean < end) ? clean : end) - start;
+    }
+    if (end > a->zero_from) a->zero_from = end;
+}
+
+/**
+ * @name    align_block
+ * @brief   Moves the start of the free block p forward so its user block is aligned to align.
+ *
+ * The skipped front of p is given back as a free block of its own. It
+ * cannot be merged with its predecessor, as p was free and free blocks
+ * are never adjacent.
+ *
+ * @param   BlockHeader * p A free block already taken out of its size class.
+ * @retval  The header of the aligned block, which covers the rest of p.
+ */
+static BlockHeader * align_block(Arena * a, BlockHeader * p, size_t align) {
+    uintptr_t user = align_up((uintptr_t) p->user_block, align);
+    BlockHeader * aligned;
+
+    if (user == (uintptr_t) p->user_block) return p;
+    while (user - (uintptr_t) p->user_block < sizeof(BlockHeader) + MIN_SIZE) {
+        user += align;   // The front is too small to be a block
+    }
+    aligned = (BlockHeader *) (user - sizeof(BlockHeader));
+    INIT_NEXT(aligned, GET_NEXT(p));
+    SET_NEXT(p, aligned);
+    set_free(p);
+    free_insert(a, p);
+    return aligned;
+}
+
+/**
+ * @name    block_alloc
+ * @brief   Takes a block of at least size bytes from the block list of a. Called with a->lock held.
+ *
+ * @param   size_t size Requested size, already aligned and at least MIN_SIZE.
+ * @param   size_t align Alignment of the user block, a power of two. The user block is
+ *                       always 8 byte aligned, larger alignments are carved out of a
+ *                       correspondingly larger free block.
+ * @param   size_t * dirty If not NULL, set to the number of leading bytes of the user
+ *                         block that may not be zero. Apart from those only the last
+ *                         word of the user block, which may hold a footer, can be non-zero.
+ * @retval  The header of the allocated block or NULL if none is large enough.
+ */
+static BlockHeader * block_alloc(Arena * a, size_t size, size_t align, size_t * dirty) {
+    size_t needed = (align > sizeof(uintptr_t)) ? size + align + sizeof(BlockHeader) + MIN_SIZE : size;
+    BlockHeader * block;
+
+    if (a->first == NULL) return NULL;   // No memory given to this arena
+
+    // Next fit first: the block following the previous allocation is usually the remainder of the last split
+    if (placements[policy].next_fit && GET_FREE(a->current) && SIZE(a->current) >= needed) {
+        block = a->current;
+    } else {
+        block = find_fit(a, needed);
+        if (block == NULL) return NULL;   // None found
+    }
+
+    free_remove(a, block);
+    if (align > sizeof(uintptr_t)) {
+        block = align_block(a, block, align);
+    }
+    split(a, block, size);
+    set_used(block);
+    a->current = GET_NEXT(block);
+    note_touched(a, block, dirty);
+    count_used(SIZE(block), 1);
+    return block;
+}
+
+/**
+ * @name    block_release
+ * @brief   Returns an allocated block to the block list of its arena. Called with its lock held.
+ */
+static void block_release(Arena * a, BlockHeader * block) {
+    if (GET_FREE(block)) {
+        return; //block is already free
+    }
+    count_used(-(ptrdiff_t) SIZE(block), -1);
+    free_insert(a, coalesce(a, block));
+}
+
+/**
+ * @name    drain_remote_frees
+ * @brief   Releases all blocks other threads have queued on a. Called with a->lock held.
+ *
+ * The whole stack is detached with one atomic exchange, so producers can
+ * keep pushing while it is released. Under the real-time policy nothing is
+ * queued any more, but blocks left from before it was selected are popped
+ * at most REMOTE_DRAIN_MAX at a time. Holding the lock makes this the only
+ * thread popping, so the head cannot be popped and pushed again meanwhile.
+ */
+static void drain_remote_frees(Arena * a) {
+    BlockHeader * p;
+    int n;
+
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL) return;
+    if (realtime()) {
+        for (n = 0; n < REMOTE_DRAIN_MAX; n++) {
+            p = __atomic_load_n(&a->remote_frees, __ATOMIC_ACQUIRE);
+            do {
+                if (p == NULL) return;
+            } while (!__atomic_compare_exchange_n(&a->remote_frees, &p, GET_FD(p), 1,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+            block_release(a, p);
+        }
+        return;
+    }
+    p = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (p != NULL) {
+        BlockHeader * next = GET_FD(p);
+        block_release(a, p);
+        p = next;
+    }
+}
+
+/**
+ * @name    arena_grow
+ * @brief   Gives a a chunk of the reserve with a free block of at least size bytes. Called with a->lock held.
+ *
+ * A chunk that directly follows the last region of a extends that region:
+ * its dummy block becomes the header of the new memory and is merged with
+ * a free block before it. Any other chunk is added as a region of its own.
+ *
+ * @retval  0 if ok, -1 if the reserve is used up or not set, or the region table is full.
+ */
+static int arena_grow(Arena * a, size_t size) {
+    size_t len = align_up(size + MIN_REGION, GROW_CHUNK);
+    BlockHeader * old_last = a->last;
+    BlockHeader * last, * p;
+    uintptr_t start;
+    unsigned int i;
+
+    pthread_mutex_lock(&region_lock);
+    start = reserve_next;
+    if (len < size || reserve_end - start < len) {
+        pthread_mutex_unlock(&region_lock);
+        return -1;
+    }
+    for (i = 0; i < num_regions; i++) {
+        if (regions[i].arena == a && regions[i].end == start && (uintptr_t) old_last == start - DUMMY_SIZE &&
+            start + len - regions[i].start <= MAX_REGION) break;
+    }
+    // A chunk that needs a region of its own is only taken while the table has room for it
+    if ((i == num_regions && num_regions == MAX_REGIONS) ||
+        mprotect((void *) start, len, PROT_READ | PROT_WRITE) != 0) {
+        pthread_mutex_unlock(&region_lock);
+        return -1;
+    }
+    reserve_next = start + len;
+    if (i == num_regions) {
+        pthread_mutex_unlock(&region_lock);
+        if (region_add(a, start, start + len, 1) == 0) return 0;
+
+        // The table filled up meanwhile. The chunk is untouched, so it goes back to the reserve
+        pthread_mutex_lock(&region_lock);
+        mprotect((void *) start, len, PROT_NONE);
+        if (reserve_next == start + len) reserve_next = start;
+        pthread_mutex_unlock(&region_lock);
+        return -1;
+    }
+    __atomic_store_n(&regions[i].end, start + len, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&region_lock);
+
+    last = (BlockHeader *) (start + len - DUMMY_SIZE);
+    INIT_NEXT(last, start + len + HEADER_PAD);
+    SET_DUMMY_LINK(last, a->first);
+    SET_NEXT(old_last, last);
+    a->last = last;
+
+    // The new memory is zero, so the known zero memory grows unless it ended elsewhere
+    if (a->zero_end != (uintptr_t) old_last) a->zero_from = (uintptr_t) old_last;
+    a->zero_end = (uintptr_t) last;
+
+    p = coalesce(a, old_last);
+    if (p != old_last) {
+        // Old footer and dummy block are now inside the merged block
+        memset((char *) old_last - FOOTER_SIZE, 0, FOOTER_SIZE + DUMMY_SIZE);
+    }
+    free_insert(a, p);
+    return 0;
+}
+
+/**
+ * @name    arena_alloc
+ * @brief   Allocates from the arena of the calling thread, falling back to the others when it is full.
+ *
+ * When all are full, the arena of the calling thread grows, if possible
+ * and the real-time policy is not in use.
+ *
+ * @param   size_t size Requested size, already aligned and at least MIN_SIZE.
+ * @param   size_t align Alignment of the user block, see block_alloc.
+ * @param   size_t * dirty Leading bytes that may not be zero, see block_alloc.
+ */
+static BlockHeader * arena_alloc(size_t size, size_t align, size_t * dirty) {
+    BlockHeader * block;
+    Arena * a;
+    int i;
+
+    a = my_arena();
+    for (i = 0; i < NUM_ARENAS; i++) {
+        pthread_mutex_lock(&a->lock);
+        drain_remote_frees(a);
+        block = block_alloc(a, size, align, dirty);
+        pthread_mutex_unlock(&a->lock);
+        if (block != NULL) return block;
+        a = (a == &arenas[NUM_ARENAS - 1]) ? &arenas[0] : a + 1;
+    }
+
+    // All arenas are full, grow the one of the calling thread if there is a reserve
+    if (realtime()) return NULL;
+    pthread_mutex_lock(&a->lock);
+    block = (arena_grow(a, size + align + sizeof(BlockHeader) + MIN_SIZE) == 0) ? block_alloc(a, size, align, dirty) : NULL;
+    pthread_mutex_unlock(&a->lock);
+    return block;
+}
+
+/**
+ * @name    arena_free
+ * @brief   Returns an allocated block to the arena it was taken from.
+ *
+ * A block from another arena than the one of the calling thread is only
+ * queued on the remote free stack of its arena, without taking the lock.
+ * Under the real-time policy it is released right away instead, so no
+ * allocation has to release an unbounded number of them.
+ */
+static void arena_free(BlockHeader * block) {
+    Arena * a = arena_of(block);
+
+    if (a != thread_arena && !realtime()) {
+        BlockHeader * head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+        do {
+            SET_FD(block, head);
+        } while (!__atomic_compare_exchange_n(&a->remote_frees, &head, block, 1,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    block_release(a, block);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * @name    tcache_flush
+ * @brief   Returns all blocks cached by the exiting thread to their arenas.
+ */
+static void tcache_flush(void * arg) {
+    TCache * tc = (TCache *) arg;
+    size_t i;
+
+    for (i = 0; i < TCACHE_BINS; i++) {
+        while (tc->entries[i] != NULL) {
+            BlockHeader * block = tc->entries[i];
+            tc->entries[i] = GET_FD(block);
+            arena_free(block);
+        }
+        tc->counts[i] = 0;
+    }
+}
+
+static void tcache_key_create(void) {
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/**
+ * @name    tcache_put
+ * @brief   Caches a small allocated block in the calling thread.
+ * @retval  1 if the block was cached (or already was), 0 if the caller must release it.
+ */
+static int tcache_put(BlockHeader * block) {
+    size_t size = SIZE(block);
+    BlockHeader * p;
+    int i;
+
+    if (size > TCACHE_MAX_SIZE) return 0;
+    i = TCACHE_INDEX(size);
+
+    if (GET_BK(block) == TCACHE_KEY) {   // Possibly a double free, look for it in the cache
+        for (p = tcache.entries[i]; p != NULL; p = GET_FD(p)) {
+            if (p == block) return 1;
+        }
+    }
+    if (tcache.counts[i] >= TCACHE_FILL) return 0;
+
+    if (!tcache.registered) {
+        pthread_once(&tcache_key_once, tcache_key_create);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = 1;
+    }
+    SET_FD(block, tcache.entries[i]);
+    SET_BK(block, TCACHE_KEY);
+    tcache.entries[i] = block;
+    tcache.counts[i]++;
+    return 1;
+}
+
+int simple_set_policy(PlacementPolicy new_policy) {
+    BlockHeader * p;
+    int i;
+
+    if ((unsigned int) new_policy >= NUM_POLICIES) return -1;
+    pthread_once(&init_once, simple_init);
+
+    for (i = 0; i < NUM_ARENAS; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+    // realtime() reads the policy without an arena lock
+    __atomic_store_n(&policy, new_policy, __ATOMIC_RELAXED);
+
+    // Rebuild the index of every arena for the new policy
+    for (i = 0; i < NUM_ARENAS; i++) {
+        Arena * a = &arenas[i];
+        memset(a->bins, 0, sizeof(a->bins));
+        memset(a->sl_map, 0, sizeof(a->sl_map));
+        a->fl_map = 0;
+        a->tree = NULL;
+        a->free_bytes = 0;
+        a->free_blocks = 0;
+        p = a->first;
+        if (p == NULL) continue;
+        do {
+            if (GET_FREE(p)) free_insert(a, p);
+            p = WALK_NEXT(p);
+        } while (p != a->first);
+    }
+
+    for (i = NUM_ARENAS - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    return 0;
+}
+
+size_t simple_trim(void) {
+    size_t released = 0;
+    BlockHeader * p;
+    int i;
+
+    pthread_once(&init_once, simple_init);
+
+    for (i = 0; i < NUM_ARENAS; i++) {
+        Arena * a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        drain_remote_frees(a);
+        p = a->first;
+        while (p != NULL) {
+            if (GET_FREE(p)) {
+                // Only whole pages between the free links and the footer, which must stay intact
+                uintptr_t from = align_up((uintptr_t) p->user_block + sizeof(FreeLinks), page_size);
+                uintptr_t to = ((uintptr_t) GET_NEXT(p) - FOOTER_SIZE) & ~(page_size - 1);
+                if (to > from && madvise((void *) from, to - from, MADV_DONTNEED) == 0) {
+                    released += to - from;
+                }
+            }
+            p = WALK_NEXT(p);
+            if (p == a->first) break;
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    return released;
+}
+
+/**
+ * @name    largest_free
+ * @brief   Returns the size of the largest free block of a. Called with a->lock held.
+ *
+ * It is the rightmost node of the tree for best fit. Otherwise it is in the
+ * highest non-empty size class, whose list is searched.
+ */
+static size_t largest_free(Arena * a) {
+    BlockHeader * p;
+    size_t largest = 0;
+    int f;
+
+    if (policy == MM_BEST_FIT) {
+        for (p = a->tree; p != NULL && TREE_RIGHT(p) != NULL; p = TREE_RIGHT(p));
+        return (p != NULL) ? SIZE(p) : 0;
+    }
+    if (a->fl_map == 0) return 0;
+    f = 63 - __builtin_clzll(a->fl_map);
+    for (p = a->bins[(f << SL_LOG2) + 31 - __builtin_clz(a->sl_map[f])]; p != NULL; p = GET_FD(p)) {
+        if (SIZE(p) > largest) largest = SIZE(p);
+    }
+    return largest;
+}
+
+SimpleMallinfo simple_mallinfo(void) {
+    SimpleMallinfo info;
+    size_t largest;
+    int i;
+
+    pthread_once(&init_once, simple_init);
+    memset(&info, 0, sizeof(info));
+    info.in_use = __atomic_load_n(&used_bytes, __ATOMIC_RELAXED);
+    info.peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    info.used_blocks = __atomic_load_n(&used_blocks, __ATOMIC_RELAXED);
+
+    for (i = 0; i < NUM_ARENAS; i++) {
+        Arena * a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        info.free += a->free_bytes;
+        info.free_blocks += a->free_blocks;
+        largest = largest_free(a);
+        pthread_mutex_unlock(&a->lock);
+        if (largest > info.largest_free) info.largest_free = largest;
+
+        info.malloc_calls += __atomic_load_n(&a->calls[CALL_MALLOC], __ATOMIC_RELAXED);
+        info.free_calls += __atomic_load_n(&a->calls[CALL_FREE], __ATOMIC_RELAXED);
+        info.calloc_calls += __atomic_load_n(&a->calls[CALL_CALLOC], __ATOMIC_RELAXED);
+        info.realloc_calls += __atomic_load_n(&a->calls[CALL_REALLOC], __ATOMIC_RELAXED);
+        info.aligned_alloc_calls += __atomic_load_n(&a->calls[CALL_ALIGNED_ALLOC], __ATOMIC_RELAXED);
+    }
+    return info;
+}
+
+/**
+ * @name    ticks
+ * @brief   Reads the clock latencies are measured with.
+ */
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+/**
+ * @name    lat_bucket
+ * @brief   Returns the histogram bucket of a latency: its power of two range and the bucket within it.
+ */
+static inline int lat_bucket(uint64_t t) {
+    int f;
+
+    if (t < LAT_SUB) return (int) t;
+    f = 63 - __builtin_clzll(t);
+    return ((f - LAT_SUB_LOG2 + 1) << LAT_SUB_LOG2) + (int) ((t >> (f - LAT_SUB_LOG2)) & (LAT_SUB - 1));
+}
+
+/**
+ * @name    lat_bucket_end
+ * @brief   Returns the largest latency counted in bucket i.
+ */
+static uint64_t lat_bucket_end(int i) {
+    int shift = (i >> LAT_SUB_LOG2) - 1;
+
+    if (i < LAT_SUB) return (uint64_t) i;
+    return (((uint64_t) (LAT_SUB + (i & (LAT_SUB - 1))) + 1) << shift) - 1;
+}
+
+/**
+ * @name    lat_record
+ * @brief   Counts a call that took t ticks for a request of size bytes.
+ */
+static void lat_record(LatencyCall call, size_t size, uint64_t t) {
+    int c = (size != 0) ? (63 - __builtin_clzll((unsigned long long) size)) / 3 : 0;
+
+    if (c >= MM_LATENCY_CLASSES) c = MM_LATENCY_CLASSES - 1;
+    __atomic_fetch_add(&latencies[call][c][lat_bucket(t)], 1, __ATOMIC_RELAXED);
+}
+
+void simple_latency_enable(int on) {
+    uint64_t * count = &latencies[0][0][0];
+    size_t i;
+
+    if (on && !__atomic_load_n(&latency_on, __ATOMIC_RELAXED)) {
+        for (i = 0; i < sizeof(latencies) / sizeof(latencies[0][0][0]); i++) {
+            __atomic_store_n(&count[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&latency_on, on != 0, __ATOMIC_RELAXED);
+}
+
+LatencySummary simple_latency(LatencyCall call, int size_class) {
+    LatencySummary sum;
+    uint64_t counts[LAT_BUCKETS];
+    uint64_t seen = 0;
+    int i, c;
+
+    memset(&sum, 0, sizeof(sum));
+    if ((unsigned int) call >= LAT_CALLS || size_class >= MM_LATENCY_CLASSES) return sum;
+
+    // Take the counts once, as they keep changing while other threads run
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        counts[i] = 0;
+        for (c = 0; c < MM_LATENCY_CLASSES; c++) {
+            if (size_class < 0 || c == size_class) {
+                counts[i] += __atomic_load_n(&latencies[call][c][i], __ATOMIC_RELAXED);
+            }
+        }
+        sum.count += counts[i];
+    }
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        if (counts[i] == 0) continue;
+        seen += counts[i];
+        // Rank q * count, rounded up, falls in this bucket
+        if (sum.p50 == 0 && seen * 2 >= sum.count) sum.p50 = lat_bucket_end(i);
+        if (sum.p99 == 0 && seen * 100 >= sum.count * 99) sum.p99 = lat_bucket_end(i);
+        if (sum.p999 == 0 && seen * 1000 >= sum.count * 999) sum.p999 = lat_bucket_end(i);
+        sum.max = lat_bucket_end(i);
+    }
+    return sum;
+}
+
+void simple_latency_dump(FILE * out) {
+    static const char * const names[LAT_CALLS] = { "malloc", "free" };
+    LatencySummary sum;
+    int call, c;
+
+    fprintf(out, "%-8s %-10s %12s %10s %10s %10s %10s\n", "call", "size", "count", "p50", "p99", "p999", "max");
+    for (call = 0; call < LAT_CALLS; call++) {
+        for (c = 0; c < MM_LATENCY_CLASSES; c++) {
+            sum = simple_latency((LatencyCall) call, c);
+            if (sum.count == 0) continue;
+            fprintf(out, "%-8s < 2^%-6d %12llu %10llu %10llu %10llu %10llu\n", names[call],
+                    (c < MM_LATENCY_CLASSES - 1) ? 3 * (c + 1) : 64, (unsigned long long) sum.count,
+                    (unsigned long long) sum.p50, (unsigned long long) sum.p99,
+                    (unsigned long long) sum.p999, (unsigned long long) sum.max);
+        }
+    }
+}
+
+/* Include the trace recorder, used by the public functions below */
+
+#include "mm_trace.c"
+
+/**
+ * @name    mapped_alloc
+ * @brief   Allocates a block in a mapping of its own if size is at least mmap_threshold.
+ *
+ * The header sits right before the user block, within the first page of
+ * the mapping, and points to the end of the mapping. Any block outside the
+ * regions was allocated this way. Never done under the real-time policy,
+ * as the cost of a system call has no bound.
+ *
+ * @param   size_t align Alignment of the user block, at most the page size.
+ * @param   size_t * dirty Set to 0, as new mappings are zero.
+ * @retval  The header of the block or NULL if it should come from an arena instead.
+ */
+static BlockHeader * mapped_alloc(size_t size, size_t align, size_t * dirty) {
+    size_t threshold, offset, len;
+    BlockHeader * block;
+    void * base;
+
+    pthread_once(&init_once, simple_init);
+    threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+    if (threshold == 0 || size < threshold || align > page_size || realtime()) return NULL;
+
+    offset = (align > sizeof(uintptr_t)) ? align : sizeof(uintptr_t);
+    len = align_up(offset + size, page_size);
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+
+    advise_huge((uintptr_t) base, len);
+
+    block = (BlockHeader *) ((uintptr_t) base + offset - sizeof(BlockHeader));
+    INIT_NEXT(block, (uintptr_t) base + len);
+    *dirty = 0;
+    count_used(SIZE(block), 1);
+    return block;
+}
+
+/**
+ * @name    mapped_free
+ * @brief   Unmaps a block allocated by mapped_alloc.
+ */
+static void mapped_free(BlockHeader * block) {
+    uintptr_t base = (uintptr_t) block & ~(page_size - 1);
+    count_used(-(ptrdiff_t) SIZE(block), -1);
+    munmap((void *) base, (uintptr_t) GET_NEXT(block) - base);
+}
+
+void simple_set_mmap_threshold(size_t threshold) {
+    __atomic_store_n(&mmap_threshold, threshold, __ATOMIC_RELAXED);
+}
+
+/**
+ * @name    count_call
+ * @brief   Counts a call of a public function, in the arena of the calling thread.
+ */
+static inline void count_call(int call) {
+    __atomic_fetch_add(&my_arena()->calls[call], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @name    allocate
+ * @brief   Allocates at least size bytes, from the thread cache if possible.
+ *
+ * @param   size_t * dirty Set to the number of leading bytes that may not be zero, see block_alloc.
+ * @retval  The header of the allocated block or NULL if not possible.
+ */
+static BlockHeader * allocate(size_t size, size_t * dirty) {
+    BlockHeader * block;
+
+    if (size > MAX_REQUEST) return NULL;
+
+//Pad the requested size so the next header is aligned
+    size_t aligned_size = block_size(size);
+
+    // Small blocks are served from the thread cache without taking a lock
+    if (aligned_size <= TCACHE_MAX_SIZE) {
+        int i = TCACHE_INDEX(aligned_size);
+        block = tcache.entries[i];
+        if (block != NULL) {
+            tcache.entries[i] = GET_FD(block);
+            tcache.counts[i]--;
+            SET_BK(block, NULL);
+            *dirty = SIZE(block);
+            return block;
+        }
+    }
+
+    block = mapped_alloc(aligned_size, sizeof(uintptr_t), dirty);
+    return block ? block : arena_alloc(aligned_size, sizeof(uintptr_t), dirty);
+}
+
+void* simple_malloc(size_t size) {
+    int timed = __atomic_load_n(&latency_on, __ATOMIC_RELAXED);
+    uint64_t start = timed ? ticks() : 0;
+    size_t dirty;
+    BlockHeader * block;
+
+    count_call(CALL_MALLOC);
+    block = allocate(size, &dirty);
+    if (timed) lat_record(MM_LATENCY_MALLOC, size, ticks() - start);
+    trace(MM_TRACE_MALLOC, block ? block->user_block : NULL, 0, size);
+    return block ? (void *) block->user_block : NULL; // Return the address of the allocated block
+}
+
+/**
+ * @name    aligned_allocate
+ * @brief   Allocates at least size bytes starting at a multiple of alignment, see simple_aligned_alloc.
+ */
+static void * aligned_allocate(size_t alignment, size_t size) {
+    BlockHeader * block;
+    size_t dirty;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL;
+    if (alignment <= sizeof(uintptr_t)) {
+        block = allocate(size, &dirty);   // User blocks are always 8 byte aligned
+        return block ? (void *) block->user_block : NULL;
+    }
+    if (size > MAX_REQUEST || alignment > MAX_REQUEST) return NULL;
+
+    size_t aligned_size = block_size(size);
+
+    // The front skipped to reach the alignment is given back as a free block
+    block = mapped_alloc(aligned_size, alignment, &dirty);
+    if (block == NULL) block = arena_alloc(aligned_size, alignment, &dirty);
+    return block ? (void *) block->user_block : NULL;
+}
+
+void * simple_aligned_alloc(size_t alignment, size_t size) {
+    void * ptr;
+
+    count_call(CALL_ALIGNED_ALLOC);
+    ptr = aligned_allocate(alignment, size);
+    trace(MM_TRACE_ALIGNED_ALLOC, ptr, alignment, size);
+    return ptr;
+}
+
+/**
+ * @name    zero_allocate
+ * @brief   Allocates zeroed memory for nmemb elements of size bytes each, see simple_calloc.
+ */
+static void * zero_allocate(size_t nmemb, size_t size) {
+    BlockHeader * block;
+    size_t total, dirty, footer;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) return NULL;
+    total = nmemb * size;
+    block = allocate(total, &dirty);
+    if (block == NULL) return NULL;
+
+    // Memory never handed out is still zero, only clear what was touched
+    if (dirty >= total) {
+        memset(block->user_block, 0, total);
+    } else {
+        memset(block->user_block, 0, dirty);
+        footer = SIZE(block) - FOOTER_SIZE;
+        if (footer < total) {
+            memset((char *) block->user_block + footer, 0, total - footer);
+        }
+    }
+    return (void *) block->user_block;
+}
+
+void * simple_calloc(size_t nmemb, size_t size) {
+    void * ptr;
+
+    count_call(CALL_CALLOC);
+    ptr = zero_allocate(nmemb, size);
+    trace(MM_TRACE_CALLOC, ptr, 0, (size != 0 && nmemb > SIZE_MAX / size) ? SIZE_MAX : nmemb * size);
+    return ptr;
+}
+
+/**
+ * @name    release
+ * @brief   Frees the memory at ptr, as simple_free does but without counting the call.
+ */
+static void release(void * ptr) {
+    if (ptr == NULL) return;
+
+    BlockHeader * block = (BlockHeader *)((uintptr_t)ptr - sizeof(BlockHeader));
+    if (GET_FREE(block)) {
+        return; //block is already free
+    }
+    if (tcache_put(block)) return;
+    if (region_of(block) == NULL) {
+        mapped_free(block);
+        return;
+    }
+    arena_free(block);
+}
+
+void simple_free(void * ptr) {
+    int timed = __atomic_load_n(&latency_on, __ATOMIC_RELAXED);
+    uint64_t start = timed ? ticks() : 0;
+    size_t size = 0;
+
+    // The size class of a free is that of the block, read before it is gone
+    if (timed && ptr != NULL) size = SIZE((BlockHeader *) ((uintptr_t) ptr - sizeof(BlockHeader)));
+    count_call(CALL_FREE);
+    if (ptr != NULL) trace(MM_TRACE_FREE, ptr, 0, 0);   // Before the block can be handed out again
+    release(ptr);
+    if (timed) lat_record(MM_LATENCY_FREE, size, ticks() - start);
+}
+
+/**
+ * @name    block_resize
+ * @brief   Resizes the allocated block in place, shrinking it or absorbing a free block after it.
+ *
+ * @param   size_t size New size, already aligned and at least MIN_SIZE.
+ * @retval  1 if the block now holds at least size bytes, 0 if it has to be moved.
+ */
+static int block_resize(BlockHeader * block, size_t size) {
+    Arena * a = arena_of(block);
+    size_t old_size = SIZE(block);
+    BlockHeader * next;
+    int resized = 0;
+
+    pthread_mutex_lock(&a->lock);
+    next = GET_NEXT(block);
+    if (SIZE(block) >= size) {
+        split(a, block, size);   // Only splits if the tail can hold a block of its own
+        resized = 1;
+    } else if (GET_FREE(next) && SIZE(block) + sizeof(BlockHeader) + SIZE(next) >= size) {
+        free_remove(a, next);
+        SET_NEXT(block, GET_NEXT(next));
+        split(a, block, size);
+        set_used(block);
+        if (a->current == next) a->current = GET_NEXT(block);
+        note_touched(a, block, NULL);
+        resized = 1;
+    }
+    if (resized) count_used((ptrdiff_t) SIZE(block) - (ptrdiff_t) old_size, 0);
+    pthread_mutex_unlock(&a->lock);
+    return resized;
+}
+
+void * simple_realloc(void * ptr, size_t size) {
+    BlockHeader * block, * moved;
+    size_t dirty;
+    int resized;
+
+    count_call(CALL_REALLOC);
+    if (ptr == NULL) {
+        moved = allocate(size, &dirty);
+        trace(MM_TRACE_REALLOC, moved ? moved->user_block : NULL, 0, size);
+        return moved ? (void *) moved->user_block : NULL;
+    }
+    if (size == 0) {
+        trace(MM_TRACE_REALLOC, NULL, (uintptr_t) ptr, 0);
+        release(ptr);
+        return NULL;
+    }
+    if (size > MAX_REQUEST) {
+        trace(MM_TRACE_REALLOC, NULL, (uintptr_t) ptr, size);
+        return NULL;
+    }
+
+    size_t aligned_size = block_size(size);
+
+    block = (BlockHeader *)((uintptr_t)ptr - sizeof(BlockHeader));
+    if (region_of(block) == NULL) {
+        // A mapped block is kept while it is large enough and the request still counts as huge
+        resized = SIZE(block) >= aligned_size && aligned_size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+    } else {
+        resized = block_resize(block, aligned_size);
+    }
+    if (resized) {
+        trace(MM_TRACE_REALLOC, ptr, (uintptr_t) ptr, size);
+        return ptr;
+    }
+
+    // Last resort: move the contents to a new block
+    moved = allocate(size, &dirty);
+    trace(MM_TRACE_REALLOC, moved ? moved->user_block : NULL, (uintptr_t) ptr, size);
+    if (moved == NULL) return NULL;
+    memcpy(moved->user_block, ptr, (SIZE(block) < size) ? SIZE(block) : size);
+    release(ptr);
+    return (void *) moved->user_block;
+}
+
+/* Include the slab allocator, which builds on the arenas */
+
+#include "mm_slab.c"
+
 /* Include test routines */
 
 #include "mm_aux.c"
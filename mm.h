@@ -26,6 +26,312 @@ void * simple_malloc(size_t size);
 void simple_free(void * ptr);
 
 
+/**
+ * @name    simple_aligned_alloc
+ * @brief   Allocate at least size bytes starting at a multiple of alignment, e.g. 16, 32, 64 or 4096.
+ *
+ * The memory is freed with simple_free like any other. simple_realloc keeps
+ * the alignment only if the block can be resized in place.
+ *
+ * @retval  Pointer to the start of the allocated memory or NULL if not possible or
+ *          if alignment is not a power of two.
+ */
+void * simple_aligned_alloc(size_t alignment, size_t size);
+
+
+/**
+ * @name    simple_calloc
+ * @brief   Allocate zeroed memory for an array of nmemb elements of size bytes each.
+ * @retval  Pointer to the start of the allocated memory or NULL if not possible.
+ */
+void * simple_calloc(size_t nmemb, size_t size);
+
+
+/**
+ * @name    simple_realloc
+ * @brief   Changes the size of previously allocated memory to at least size bytes, keeping its contents.
+ *
+ * The block is shrunk or grown in place when possible, otherwise the contents
+ * are moved to a new block. A NULL ptr behaves like simple_malloc, and a size
+ * of 0 like simple_free.
+ *
+ * @retval  Pointer to the resized memory, or NULL if not possible. The old memory is then left untouched.
+ */
+void * simple_realloc(void * ptr, size_t size);
+
+
+/**
+ * @name    PlacementPolicy
+ * @brief   How simple_malloc picks among the free blocks large enough for a request.
+ *
+ * The policy in use from the start can be set with the MM_POLICY environment
+ * variable to "next", "best", "first", "good" or "realtime".
+ *
+ * Under MM_REALTIME, simple_malloc and simple_free take a number of steps
+ * bounded by constants, whatever the size and state of the memory:
+ *  - simple_malloc looks at one free block in each of the 4 arenas at most,
+ *    found with two find-first-set lookups, and splits it once. In each
+ *    arena it looks at, it also releases at most 4 blocks other threads
+ *    freed before the policy was selected, so 16 in all. It never maps
+ *    memory or grows the heap, so it fails once no size class above that
+ *    of the request holds a block, even if a block of the same class would
+ *    fit.
+ *  - simple_free finds the region of the block among at most 64, merges it
+ *    with at most two neighbours and links it into one size class, also
+ *    when it was allocated by another thread.
+ * Waiting for an arena lock held by another thread is not included, nor
+ * the first call, which sets up the memory, nor clearing or copying the
+ * memory itself in simple_calloc and simple_realloc, nor freeing a block
+ * mapped on its own before the policy was selected.
+ */
+typedef enum {
+    MM_NEXT_FIT,    /* Block after the previous allocation if it fits, else from the size class lists (default) */
+    MM_BEST_FIT,    /* Smallest block that fits, found in a size ordered tree */
+    MM_FIRST_FIT,   /* First block that fits in the list of blocks, found by walking it */
+    MM_GOOD_FIT,    /* Smallest of the first few fitting blocks of the size class */
+    MM_REALTIME,    /* Any block of the lowest size class above the request, in constant time */
+} PlacementPolicy;
+
+
+/**
+ * @name    simple_set_policy
+ * @brief   Selects the placement policy. May be called at any time, blocks in use are not moved.
+ * @retval  0 if ok, -1 if the policy is unknown.
+ */
+int simple_set_policy(PlacementPolicy policy);
+
+
+/**
+ * @name    simple_init_region
+ * @brief   Adds the memory from base to base + len to the memory handed out by the allocator.
+ *
+ * The region is given to the arena of the calling thread and must stay
+ * valid, and otherwise unused, for as long as the allocator is used. At
+ * most 64 regions, including the default memory, can be managed.
+ *
+ * @retval  0 if ok, -1 if the region is too small, overlaps a managed one or too many are in use.
+ */
+int simple_init_region(void * base, size_t len);
+
+
+/**
+ * @name    simple_reserve
+ * @brief   Lets the memory grow by up to len bytes, taken from a range of address space reserved now.
+ *
+ * Memory is only committed, in chunks of at least 1 MB, once all memory
+ * managed so far is in use. A further call replaces what is left of the
+ * previous reserve.
+ *
+ * @retval  0 if ok, -1 if the address space could not be reserved.
+ */
+int simple_reserve(size_t len);
+
+
+/**
+ * @name    simple_trim
+ * @brief   Gives the pages inside free blocks back to the operating system.
+ *
+ * The pages are released with madvise, so they no longer count towards the
+ * resident memory of the process and read as zero when used again. The
+ * headers of the blocks are kept, so nothing else changes.
+ *
+ * @retval  The number of bytes released, including pages released by earlier calls.
+ */
+size_t simple_trim(void);
+
+
+/**
+ * @name    simple_set_mmap_threshold
+ * @brief   Sets the size from which blocks get a mapping of their own instead of coming from the arenas.
+ *
+ * Such blocks are unmapped as soon as they are freed. The default is 4 MB,
+ * a threshold of 0 keeps all blocks in the arenas.
+ */
+void simple_set_mmap_threshold(size_t threshold);
+
+
+/**
+ * @name    SimpleMallinfo
+ * @brief   Statistics of the allocator, as returned by simple_mallinfo.
+ *
+ * Sizes are those of the user blocks, without headers. Blocks held in a
+ * thread cache or not yet released after a free from another thread still
+ * count as allocated.
+ */
+typedef struct {
+    size_t in_use;                /* Bytes in allocated blocks, including those mapped on their own */
+    size_t peak;                  /* Largest value in_use has had */
+    size_t free;                  /* Bytes in free blocks */
+    size_t largest_free;          /* Size of the largest free block */
+    size_t used_blocks;           /* Number of allocated blocks */
+    size_t free_blocks;           /* Number of free blocks */
+    size_t malloc_calls;          /* Calls of each function */
+    size_t free_calls;
+    size_t calloc_calls;
+    size_t realloc_calls;
+    size_t aligned_alloc_calls;
+} SimpleMallinfo;
+
+
+/**
+ * @name    simple_mallinfo
+ * @brief   Returns the current statistics of the allocator.
+ *
+ * All counters are kept up to date as blocks are allocated and freed, so
+ * this does not walk the blocks. Each arena is only locked to find its
+ * largest free block in the size index, and the arenas are read one after
+ * the other, so the figures need not add up exactly while other threads
+ * allocate.
+ */
+SimpleMallinfo simple_mallinfo(void);
+
+
+/**
+ * @name    LatencyCall
+ * @brief   The calls whose latency can be recorded, see simple_latency_enable.
+ */
+typedef enum {
+    MM_LATENCY_MALLOC,
+    MM_LATENCY_FREE,
+} LatencyCall;
+
+/* Latencies are recorded per size class: class c holds requests below 2^(3(c+1)) bytes, the last one all others */
+#define MM_LATENCY_CLASSES  (8)
+
+
+/**
+ * @name    LatencySummary
+ * @brief   Percentiles of the recorded latency of a call, as returned by simple_latency.
+ *
+ * Latencies are in cycles of the time stamp counter on x86, in nanoseconds
+ * elsewhere. Each one is the upper end of the histogram bucket it falls
+ * in, which is at most 1/8 above the actual value.
+ */
+typedef struct {
+    uint64_t count;     /* Number of calls recorded */
+    uint64_t p50;       /* Median */
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} LatencySummary;
+
+
+/**
+ * @name    simple_latency_enable
+ * @brief   Starts or stops recording the latency of every simple_malloc and simple_free.
+ *
+ * Starting clears what was recorded before. Recording can also be started
+ * from the first call by setting the MM_LATENCY environment variable to 1.
+ * It costs two clock reads and an atomic add per call.
+ */
+void simple_latency_enable(int on);
+
+
+/**
+ * @name    simple_latency
+ * @brief   Returns the recorded latency of call for requests of size class size_class, or all if it is -1.
+ */
+LatencySummary simple_latency(LatencyCall call, int size_class);
+
+
+/**
+ * @name    simple_latency_dump
+ * @brief   Prints the recorded latency percentiles of each call and size class to out.
+ */
+void simple_latency_dump(FILE * out);
+
+
+/**
+ * @name    TraceOp
+ * @brief   The call a TraceRecord stands for.
+ */
+typedef enum {
+    MM_TRACE_MALLOC,
+    MM_TRACE_FREE,
+    MM_TRACE_CALLOC,          /* size is the total, nmemb * size */
+    MM_TRACE_REALLOC,
+    MM_TRACE_ALIGNED_ALLOC,
+} TraceOp;
+
+/* A trace file starts with these 8 bytes, followed by the records in the order of the calls */
+#define MM_TRACE_MAGIC  { 'M', 'M', 'T', 'R', 'A', 'C', 'E', '1' }
+
+
+/**
+ * @name    TraceRecord
+ * @brief   One call in a trace file, in the byte order of the machine that recorded it.
+ */
+typedef struct {
+    uint64_t time;            /* Cycles of the time stamp counter on x86, nanoseconds elsewhere */
+    uint64_t addr;            /* Block returned, 0 if the call failed, or block freed */
+    uint64_t old;             /* Block passed to simple_realloc, alignment for simple_aligned_alloc */
+    uint32_t size;            /* Requested size, UINT32_MAX for 4 GB and more */
+    uint16_t thread;          /* Calling thread, numbered from 1 in the order of their first call */
+    uint8_t op;               /* A TraceOp */
+    uint8_t pad;
+} TraceRecord;
+
+
+/**
+ * @name    simple_trace_start
+ * @brief   Starts recording every call of the allocator to the file at path.
+ *
+ * Records are buffered in a ring and written by a thread of their own, so
+ * calls only wait for the file when the ring is full, and the rest is
+ * written when the program exits. Frees of NULL are not recorded.
+ * Tracing can also be started from the first call by setting the MM_TRACE
+ * environment variable to the path. Traces are replayed with the mm_replay
+ * tool.
+ *
+ * @retval  0 if ok, -1 if already tracing or the file could not be created.
+ */
+int simple_trace_start(const char * path);
+
+
+/**
+ * @name    simple_trace_stop
+ * @brief   Stops recording and writes the remaining records to the trace file.
+ */
+void simple_trace_stop(void);
+
+
+/**
+ * @name    SlabCache
+ * @brief   A cache of equally sized objects, packed into slabs without a header per object.
+ */
+typedef struct slab_cache SlabCache;
+
+
+/**
+ * @name    simple_slab_create
+ * @brief   Creates a cache for objects of size bytes. Objects are 8 byte aligned.
+ * @retval  Pointer to the new cache or NULL if size is too large or no memory is available.
+ */
+SlabCache * simple_slab_create(size_t size);
+
+
+/**
+ * @name    simple_slab_alloc
+ * @brief   Allocates one object from cache.
+ * @retval  Pointer to the object or NULL if no memory is available.
+ */
+void * simple_slab_alloc(SlabCache * cache);
+
+
+/**
+ * @name    simple_slab_free
+ * @brief   Returns an object previously allocated from cache.
+ */
+void simple_slab_free(SlabCache * cache, void * ptr);
+
+
+/**
+ * @name    simple_slab_destroy
+ * @brief   Frees cache together with all objects still allocated from it.
+ */
+void simple_slab_destroy(SlabCache * cache);
+
+
 /**
  * @name    The lowest address of the memory you will manage
  * @brief   This points to the lowest address of memory you will manage
@@ -52,4 +358,26 @@ int simple_macro_test(void);
  */
 void simple_block_dump(void);
 
+/* Free blocks are counted by size: bucket i holds the sizes from 2^i up to 2^(i+1) */
+#define MM_FRAG_BUCKETS  (64)
+
+/**
+ * @name    FragmentationInfo
+ * @brief   Fragmentation of the free memory, as returned by simple_fragmentation
+ */
+typedef struct {
+    double external;                    /* Share of total_free outside the largest free block of each arena */
+    size_t total_free;                  /* Bytes in free blocks */
+    size_t largest_free;                /* Size of the largest free block */
+    size_t free_blocks;                 /* Number of free blocks */
+    size_t uncoalesced;                 /* Free blocks directly followed by another free block */
+    size_t histogram[MM_FRAG_BUCKETS];  /* Number of free blocks in each size bucket */
+} FragmentationInfo;
+
+/**
+ * @name    simple_fragmentation
+ * @brief   Measures the fragmentation of the free memory in one pass over the blocks of each arena
+ */
+FragmentationInfo simple_fragmentation(void);
+
 
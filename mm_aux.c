@@ -10,13 +10,18 @@
 int simple_macro_test() {
   BlockHeader block;
   BlockHeader * p = &block;
+#ifdef COMPACT_HEADERS
+  /* Compact headers only hold distances below 4 GB */
+  void * addr[2] = { (void *) ((uintptr_t) p + 0x1234BABA), (void *) ((uintptr_t) p + 0xFEDCBAB8) };
+#else
   void * addr[2] = { (void *)  0x1234BABA, (void *) 0xFEDCBA981234BABA };
+#endif
   int i;
   int ret = 0;
 
   /* Test separately for 32 and 64 bit addresses */
   for (i =0; i < 2; i++) {
-    p->next = NULL;
+    p->size = 0;
     /* Check that next and free are properly separated */
     SET_NEXT(p, addr[i]);
     SET_FREE(p, 7);  /* only least bit should be used */
@@ -34,12 +39,14 @@ int simple_macro_test() {
     if (GET_NEXT(p) != addr[i]) return 5 + i*10;  // Next pointer damaged
 
     /* Check size for forward next pointer */
-    SET_NEXT(p, (void *) ((uintptr_t) p + sizeof(BlockHeader) + 0x100 ) );
-    if (SIZE(p) !=  0x100)      return 6 + i*10;
+    SET_NEXT(p, (void *) ((uintptr_t) p + sizeof(BlockHeader) + 0x100 + HEADER_PAD ) );
+    if (SIZE(p) !=  0x100 + HEADER_PAD)      return 6 + i*10;
 
+#ifndef COMPACT_HEADERS
     /* Check size for backward next pointer (dummy block) */
     SET_NEXT(p, (void *) ((uintptr_t) p + sizeof(BlockHeader) - 0x100 ) );
     if (SIZE(p) != 0 && SIZE(p) < 0x800000000000000 )   return 7 + i*10;
+#endif
   
   }
   return ret;
@@ -57,26 +64,82 @@ static void print_block(BlockHeader * p) {
  */
 void simple_block_dump(void) {
   BlockHeader * p;
+  Arena * a;
+  int i;
 
-  if (first == NULL) {
+  if (!initialized) {
     printf("Data structure is not initialized\n");
     return;
   }
 
-  printf("first = 0x%08lx, current = 0x%08lx\n", (uintptr_t) first, (uintptr_t) current);
+  for (i = 0; i < NUM_ARENAS; i++) {
+    a = &arenas[i];
+    printf("arena %d: first = 0x%08lx, current = 0x%08lx\n", i, (uintptr_t) a->first, (uintptr_t) a->current);
 
-  p = first;
+    p = a->first;
+    if (p == NULL) continue;
 
-  do {
-    if ((uintptr_t) p < memory_start || (uintptr_t) p >= memory_end) {
-      printf("Block pointer 0x%08lx out of range\n", (uintptr_t) p);
-      return;
-    }
+    do {
+      if (region_of(p) == NULL) {
+        printf("Block pointer 0x%08lx out of range\n", (uintptr_t) p);
+        return;
+      }
 
-    print_block(p);
+      print_block(p);
 
-    p = GET_NEXT(p);
-  } while (p != first);
+      p = WALK_NEXT(p);
+    } while (p != a->first);
+  }
 
 }
 
+
+/**
+ * @name    simple_fragmentation
+ * @brief   Measures the fragmentation of the free memory in one pass over the blocks of each arena
+ *
+ * Blocks mapped on their own are not part of any arena and not counted.
+ * Free neighbours are merged as soon as a block is freed, so uncoalesced
+ * should always be 0.
+ *
+ * A request is served from one arena, so external fragmentation is taken
+ * per arena: the free bytes outside the largest free block of their own
+ * arena, as a share of all free bytes. An idle heap thus reports 0.
+ */
+FragmentationInfo simple_fragmentation(void) {
+  FragmentationInfo info;
+  BlockHeader * p;
+  Arena * a;
+  size_t arena_free, arena_largest, scattered = 0;
+  int i;
+
+  memset(&info, 0, sizeof(info));
+  if (!initialized) return info;
+
+  for (i = 0; i < NUM_ARENAS; i++) {
+    a = &arenas[i];
+    arena_free = arena_largest = 0;
+    pthread_mutex_lock(&a->lock);
+    p = a->first;
+    while (p != NULL) {
+      if (GET_FREE(p)) {
+        arena_free += SIZE(p);
+        info.free_blocks++;
+        if (SIZE(p) > arena_largest) arena_largest = SIZE(p);
+        info.histogram[63 - __builtin_clzll((unsigned long long) SIZE(p))]++;
+        if (GET_FREE(GET_NEXT(p))) info.uncoalesced++;   // The dummy block ending a region is never free
+      }
+      p = WALK_NEXT(p);
+      if (p == a->first) break;
+    }
+    pthread_mutex_unlock(&a->lock);
+    info.total_free += arena_free;
+    scattered += arena_free - arena_largest;
+    if (arena_largest > info.largest_free) info.largest_free = arena_largest;
+  }
+
+  if (info.total_free > 0) {
+    info.external = (double) scattered / (double) info.total_free;
+  }
+  return info;
+}
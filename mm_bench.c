@@ -0,0 +1,309 @@
+/**
+ * @file   mm_bench.c
+ * @brief  Microbenchmarks of simple_malloc against the malloc of the C library.
+ *
+ * Usage: mm_bench [BENCHMARK...]
+ *
+ * Each benchmark runs once per allocator, in a process of its own, so every
+ * run starts from fresh memory and its peak figures are its own. An
+ * operation is one call of malloc, free or realloc. Reported are the
+ * operations per second, the time per operation, the peak of the memory in
+ * use as counted by simple_mallinfo (only for simple_malloc) and the peak
+ * resident memory of the process.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+
+typedef struct {
+    const char * name;
+    void * (*malloc)(size_t size);
+    void (*free)(void * ptr);
+    void * (*realloc)(void * ptr, size_t size);
+} Allocator;
+
+static const Allocator allocators[] = {
+    { "simple", simple_malloc, simple_free, simple_realloc },
+    { "libc",   malloc,        free,        realloc },
+};
+
+static const Allocator * A;   // Allocator of the running benchmark
+
+#define THREADS  (4)
+
+/**
+ * @name    next_random
+ * @brief   Steps a linear congruential generator, so every run sees the same sizes.
+ */
+static inline uint32_t next_random(uint32_t * state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/**
+ * @name    touch
+ * @brief   Writes to the first byte of a block, as a program would, and checks it was handed out.
+ */
+static inline void touch(void * ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "%s ran out of memory\n", A->name);
+        exit(1);
+    }
+    *(volatile char *) ptr = 1;
+}
+
+/* Fixed size churn: a window of live blocks, the oldest replaced by a new one each step */
+#define CHURN_LIVE   (1024)
+#define CHURN_STEPS  (4000000)
+
+static uint64_t bench_churn(void) {
+    static void * live[CHURN_LIVE];
+    int i;
+
+    for (i = 0; i < CHURN_LIVE; i++) touch(live[i] = A->malloc(64));
+    for (i = 0; i < CHURN_STEPS; i++) {
+        A->free(live[i % CHURN_LIVE]);
+        touch(live[i % CHURN_LIVE] = A->malloc(64));
+    }
+    for (i = 0; i < CHURN_LIVE; i++) A->free(live[i]);
+    return 2 * (uint64_t) (CHURN_LIVE + CHURN_STEPS);
+}
+
+/* Random sizes: a random live block is replaced by one of random size up to RANDOM_MAX */
+#define RANDOM_LIVE   (4096)
+#define RANDOM_MAX    (4096)
+#define RANDOM_STEPS  (2000000)
+
+static uint64_t bench_random(void) {
+    static void * live[RANDOM_LIVE];
+    uint32_t seed = 42;
+    int i, j;
+
+    for (i = 0; i < RANDOM_LIVE; i++) touch(live[i] = A->malloc(next_random(&seed) % RANDOM_MAX + 1));
+    for (i = 0; i < RANDOM_STEPS; i++) {
+        j = next_random(&seed) % RANDOM_LIVE;
+        A->free(live[j]);
+        touch(live[j] = A->malloc(next_random(&seed) % RANDOM_MAX + 1));
+    }
+    for (i = 0; i < RANDOM_LIVE; i++) A->free(live[i]);
+    return 2 * (uint64_t) (RANDOM_LIVE + RANDOM_STEPS);
+}
+
+/* Batches of blocks freed in the reverse order of allocation, or in the same order */
+#define BATCH_SIZE    (10000)
+#define BATCH_ROUNDS  (200)
+
+static uint64_t bench_batches(int lifo) {
+    static void * batch[BATCH_SIZE];
+    int r, i;
+
+    for (r = 0; r < BATCH_ROUNDS; r++) {
+        for (i = 0; i < BATCH_SIZE; i++) touch(batch[i] = A->malloc(256));
+        for (i = 0; i < BATCH_SIZE; i++) A->free(batch[lifo ? BATCH_SIZE - 1 - i : i]);
+    }
+    return 2 * (uint64_t) BATCH_SIZE * BATCH_ROUNDS;
+}
+
+static uint64_t bench_lifo(void) {
+    return bench_batches(1);
+}
+
+static uint64_t bench_fifo(void) {
+    return bench_batches(0);
+}
+
+/* Producer-consumer: one thread allocates, another frees, through a ring of slots.
+ * Waiting threads yield, so the benchmark also makes progress on a single CPU. */
+#define PC_RING   (1024)
+#define PC_ITEMS  (1000000)
+
+static void * pc_ring[PC_RING];
+
+static void * pc_consumer(void * arg) {
+    void * ptr;
+    int i;
+
+    for (i = 0; i < PC_ITEMS; i++) {
+        while ((ptr = __atomic_load_n(&pc_ring[i % PC_RING], __ATOMIC_ACQUIRE)) == NULL) sched_yield();
+        __atomic_store_n(&pc_ring[i % PC_RING], NULL, __ATOMIC_RELEASE);
+        A->free(ptr);
+    }
+    return NULL;
+}
+
+static uint64_t bench_producer_consumer(void) {
+    pthread_t consumer;
+    void * ptr;
+    int i;
+
+    pthread_create(&consumer, NULL, pc_consumer, NULL);
+    for (i = 0; i < PC_ITEMS; i++) {
+        touch(ptr = A->malloc(16 + i % 240));
+        while (__atomic_load_n(&pc_ring[i % PC_RING], __ATOMIC_ACQUIRE) != NULL) sched_yield();
+        __atomic_store_n(&pc_ring[i % PC_RING], ptr, __ATOMIC_RELEASE);
+    }
+    pthread_join(consumer, NULL);
+    return 2 * (uint64_t) PC_ITEMS;
+}
+
+/* Realloc growth: several buffers grown in turns by a few bytes at a time, as by appending */
+#define GROW_BUFFERS  (8)
+#define GROW_STEP     (64)
+#define GROW_MAX      (64 * 1024)
+#define GROW_ROUNDS   (40)
+
+static uint64_t bench_realloc(void) {
+    void * buf[GROW_BUFFERS];
+    size_t size;
+    int r, i;
+
+    for (r = 0; r < GROW_ROUNDS; r++) {
+        for (i = 0; i < GROW_BUFFERS; i++) buf[i] = NULL;
+        for (size = GROW_STEP; size <= GROW_MAX; size += GROW_STEP) {
+            for (i = 0; i < GROW_BUFFERS; i++) touch(buf[i] = A->realloc(buf[i], size));
+        }
+        for (i = 0; i < GROW_BUFFERS; i++) A->free(buf[i]);
+    }
+    return (uint64_t) GROW_ROUNDS * GROW_BUFFERS * (GROW_MAX / GROW_STEP + 1);
+}
+
+/*
+ * Larson style: each thread replaces random blocks of small random size in
+ * a set of its own. After every round the sets are passed on to the next
+ * thread, so most blocks are freed by another thread than allocated them.
+ */
+#define LARSON_LIVE    (4000)
+#define LARSON_STEPS   (100000)
+#define LARSON_ROUNDS  (10)
+
+static void * larson_sets[THREADS][LARSON_LIVE];
+static pthread_barrier_t larson_barrier;
+
+static void * larson_worker(void * arg) {
+    int id = (int) (intptr_t) arg;
+    uint32_t seed = 1234 + id;
+    void ** set;
+    int r, i, j;
+
+    for (i = 0; i < LARSON_LIVE; i++) touch(larson_sets[id][i] = A->malloc(next_random(&seed) % 500 + 8));
+    for (r = 0; r < LARSON_ROUNDS; r++) {
+        pthread_barrier_wait(&larson_barrier);
+        set = larson_sets[(id + r) % THREADS];
+        for (i = 0; i < LARSON_STEPS; i++) {
+            j = next_random(&seed) % LARSON_LIVE;
+            A->free(set[j]);
+            touch(set[j] = A->malloc(next_random(&seed) % 500 + 8));
+        }
+    }
+    pthread_barrier_wait(&larson_barrier);
+    for (i = 0; i < LARSON_LIVE; i++) A->free(larson_sets[id][i]);
+    return NULL;
+}
+
+static uint64_t bench_larson(void) {
+    pthread_t threads[THREADS];
+    intptr_t i;
+
+    pthread_barrier_init(&larson_barrier, NULL, THREADS);
+    for (i = 0; i < THREADS; i++) pthread_create(&threads[i], NULL, larson_worker, (void *) i);
+    for (i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&larson_barrier);
+    return 2 * (uint64_t) THREADS * (LARSON_LIVE + LARSON_ROUNDS * LARSON_STEPS);
+}
+
+static const struct {
+    const char * name;
+    uint64_t (*run)(void);    // Returns the number of operations done
+} benchmarks[] = {
+    { "churn",             bench_churn },
+    { "random",            bench_random },
+    { "lifo",              bench_lifo },
+    { "fifo",              bench_fifo },
+    { "producer-consumer", bench_producer_consumer },
+    { "realloc",           bench_realloc },
+    { "larson",            bench_larson },
+};
+
+#define NUM_BENCHMARKS  (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @name    run
+ * @brief   Runs benchmark b with allocator a in a child process and prints its line of results.
+ */
+static void run(size_t b, const Allocator * a) {
+    struct rusage usage;
+    double start, elapsed;
+    uint64_t ops;
+    pid_t pid;
+    char peak[32];
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    A = a;
+    start = now();
+    ops = benchmarks[b].run();
+    elapsed = now() - start;
+
+    getrusage(RUSAGE_SELF, &usage);
+    if (a->malloc == simple_malloc) {
+        snprintf(peak, sizeof(peak), "%zu", simple_mallinfo().peak / 1024);
+    } else {
+        snprintf(peak, sizeof(peak), "-");
+    }
+    printf("%-18s %-7s %12.0f %8.1f %12s %12ld\n", benchmarks[b].name, a->name,
+           ops / elapsed, elapsed * 1e9 / ops, peak, usage.ru_maxrss);
+    fflush(stdout);
+    _exit(0);
+}
+
+int main(int argc, char ** argv) {
+    size_t b, a;
+    int i, found;
+
+    for (i = 1; i < argc; i++) {
+        for (b = 0, found = 0; b < NUM_BENCHMARKS; b++) found |= strcmp(argv[i], benchmarks[b].name) == 0;
+        if (!found) {
+            fprintf(stderr, "Unknown benchmark %s, choose from:", argv[i]);
+            for (b = 0; b < NUM_BENCHMARKS; b++) fprintf(stderr, " %s", benchmarks[b].name);
+            fprintf(stderr, "\n");
+            return 2;
+        }
+    }
+
+    printf("%-18s %-7s %12s %8s %12s %12s\n", "benchmark", "malloc", "ops/s", "ns/op", "peak use KB", "peak RSS KB");
+    for (b = 0; b < NUM_BENCHMARKS; b++) {
+        for (i = 1, found = (argc == 1); i < argc; i++) found |= strcmp(argv[i], benchmarks[b].name) == 0;
+        if (!found) continue;
+        for (a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+            run(b, &allocators[a]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file   mm_replay.c
+ * @brief  Replays a trace recorded with simple_trace_start against the allocator.
+ *
+ * Usage: mm_replay TRACE [POLICY]
+ *
+ * The calls are replayed in the order they were recorded, from a single
+ * thread, with the placement policy given or the one set by MM_POLICY.
+ * Addresses in the trace are mapped to the blocks handed out during the
+ * replay. Reports the throughput, the peak memory in use and the
+ * fragmentation, sampled every SAMPLE_EVERY calls and at the end. The
+ * samples are not part of the measured time.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define SAMPLE_EVERY  (65536)
+
+/*
+ * Blocks live in the replay, keyed by their address in the trace, in an
+ * open addressing table with linear probing. Removal shifts later entries
+ * back, so no tombstones are needed.
+ */
+typedef struct {
+    uint64_t key;    // 0 for an empty slot
+    void * ptr;
+} Entry;
+
+static Entry * table = NULL;
+static size_t table_size = 0;   // A power of two
+static size_t table_used = 0;
+
+static size_t slot_of(uint64_t key) {
+    return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 16) & (table_size - 1);
+}
+
+static void table_put(uint64_t key, void * ptr);
+
+static void table_grow(void) {
+    Entry * old = table;
+    size_t old_size = table_size, i;
+
+    table_size = old_size ? old_size * 2 : 1024;
+    table = calloc(table_size, sizeof(Entry));
+    if (table == NULL) {
+        fprintf(stderr, "Out of memory for the address table\n");
+        exit(1);
+    }
+    table_used = 0;
+    for (i = 0; i < old_size; i++) {
+        if (old[i].key != 0) table_put(old[i].key, old[i].ptr);
+    }
+    free(old);
+}
+
+static void table_put(uint64_t key, void * ptr) {
+    size_t i;
+
+    if (2 * (table_used + 1) > table_size) table_grow();
+    for (i = slot_of(key); table[i].key != 0 && table[i].key != key; i = (i + 1) & (table_size - 1));
+    if (table[i].key == 0) table_used++;
+    table[i].key = key;
+    table[i].ptr = ptr;
+}
+
+/**
+ * @name    table_take
+ * @brief   Removes key from the table.
+ * @retval  The block stored for it, or NULL if there is none.
+ */
+static void * table_take(uint64_t key) {
+    size_t i, j, home;
+    void * ptr;
+
+    if (table_size == 0) return NULL;
+    for (i = slot_of(key); table[i].key != key; i = (i + 1) & (table_size - 1)) {
+        if (table[i].key == 0) return NULL;
+    }
+    ptr = table[i].ptr;
+
+    // Move back every following entry that would no longer be found
+    for (j = (i + 1) & (table_size - 1); table[j].key != 0; j = (j + 1) & (table_size - 1)) {
+        home = slot_of(table[j].key);
+        if (((j - home) & (table_size - 1)) >= ((j - i) & (table_size - 1))) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].key = 0;
+    table_used--;
+    return ptr;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @name    replay
+ * @brief   Replays one recorded call.
+ * @retval  1 if the call failed where it had succeeded in the trace, otherwise 0.
+ */
+static int replay(const TraceRecord * r) {
+    void * ptr = NULL, * old;
+
+    switch (r->op) {
+        case MM_TRACE_MALLOC:
+            ptr = simple_malloc(r->size);
+            break;
+        case MM_TRACE_CALLOC:
+            ptr = simple_calloc(1, r->size);
+            break;
+        case MM_TRACE_ALIGNED_ALLOC:
+            ptr = simple_aligned_alloc((size_t) r->old, r->size);
+            break;
+        case MM_TRACE_FREE:
+            simple_free(table_take(r->addr));
+            return 0;
+        case MM_TRACE_REALLOC:
+            old = (r->old != 0) ? table_take(r->old) : NULL;
+            if (r->old != 0 && old == NULL) return 0;   // Block from before the trace started
+            ptr = simple_realloc(old, r->size);
+            if (old != NULL && r->size != 0 && (ptr == NULL || r->addr == 0)) {
+                // Where either call failed the caller keeps the block, moved or not
+                table_put(r->old, ptr ? ptr : old);
+                return ptr == NULL && r->addr != 0;
+            }
+            break;
+        default:
+            return 0;
+    }
+
+    if (r->addr == 0) {
+        // Failed in the trace, so the caller never used nor freed the block
+        simple_free(ptr);
+        return 0;
+    }
+    if (ptr == NULL) return 1;
+    table_put(r->addr, ptr);
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    static const char * const policies[] = { "next", "best", "first", "good", "realtime" };
+    static const char magic[8] = MM_TRACE_MAGIC;
+    char head[8];
+    TraceRecord * recs = NULL;
+    size_t n = 0, cap = 0, i, failed = 0;
+    FragmentationInfo frag;
+    SimpleMallinfo info;
+    double start, elapsed = 0.0, worst_frag = 0.0;
+    unsigned int p;
+    FILE * f;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s TRACE [next|best|first|good|realtime]\n", argv[0]);
+        return 2;
+    }
+
+    f = fopen(argv[1], "rb");
+    if (f == NULL || fread(head, 1, sizeof(head), f) != sizeof(head) || memcmp(head, magic, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a trace file\n", argv[1]);
+        return 1;
+    }
+    for (;;) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 65536;
+            recs = realloc(recs, cap * sizeof(TraceRecord));
+            if (recs == NULL) {
+                fprintf(stderr, "Out of memory for the trace\n");
+                return 1;
+            }
+        }
+        if (fread(&recs[n], sizeof(TraceRecord), 1, f) != 1) break;
+        n++;
+    }
+    fclose(f);
+
+    if (argc == 3) {
+        for (p = 0; p < sizeof(policies) / sizeof(policies[0]) && strcmp(argv[2], policies[p]) != 0; p++);
+        if (p == sizeof(policies) / sizeof(policies[0]) || simple_set_policy((PlacementPolicy) p) != 0) {
+            fprintf(stderr, "Unknown policy %s\n", argv[2]);
+            return 2;
+        }
+    }
+
+    start = now();
+    for (i = 0; i < n; i++) {
+        failed += replay(&recs[i]);
+        if ((i + 1) % SAMPLE_EVERY == 0) {
+            elapsed += now() - start;
+            frag = simple_fragmentation();
+            if (frag.external > worst_frag) worst_frag = frag.external;
+            start = now();
+        }
+    }
+    elapsed += now() - start;
+
+    info = simple_mallinfo();
+    frag = simple_fragmentation();
+    if (frag.external > worst_frag) worst_frag = frag.external;
+
+    printf("calls           %zu\n", n);
+    printf("failed          %zu\n", failed);
+    printf("throughput      %.0f calls/s, %.1f ns/call\n", n / elapsed, n ? elapsed * 1e9 / n : 0.0);
+    printf("peak in use     %zu bytes\n", info.peak);
+    printf("in use at end   %zu bytes in %zu blocks\n", info.in_use, info.used_blocks);
+    printf("free at end     %zu bytes in %zu blocks, largest %zu\n", frag.total_free, frag.free_blocks, frag.largest_free);
+    printf("fragmentation   %.3f at end, %.3f at worst\n", frag.external, worst_frag);
+
+    free(recs);
+    free(table);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* Slab allocator to be included at the end of mm.c */
+
+/*
+ * A slab is a SLAB_SIZE block taken from the arenas and aligned to
+ * SLAB_SIZE, so the slab of an object is found by masking its address.
+ * It starts with a Slab header and a bitmap with one bit per slot, set
+ * while the slot is free, followed by the slots themselves. Objects carry
+ * no header of their own.
+ */
+#define SLAB_SIZE        (16 * 1024)
+#define SLAB_MIN_SLOTS   (8)       // Objects larger than SLAB_SIZE / SLAB_MIN_SLOTS are refused
+#define SLAB_OF(ptr)     ((Slab *) ((uintptr_t) (ptr) & ~(uintptr_t) (SLAB_SIZE - 1)))
+
+typedef struct slab {
+    struct slab_cache * cache;   // Cache the slab belongs to
+    struct slab * next;          // Neighbours in the partial or full list of the cache
+    struct slab * prev;
+    uint32_t used;               // Number of allocated slots
+    uint32_t hint;               // Bitmap word to start looking for a free slot
+    uint64_t bitmap[];           // Bit set when the slot is free
+} Slab;
+
+struct slab_cache {
+    pthread_mutex_t lock;        // Protects the cache and all its slabs
+    size_t size;                 // Object size, a multiple of 8
+    uint32_t slots;              // Objects per slab
+    uint32_t words;              // 64 bit words in the bitmap of each slab
+    size_t offset;               // Offset of the first slot from the start of the slab
+    Slab * partial;              // Slabs with at least one free slot
+    Slab * full;                 // Slabs without free slots
+};
+
+/**
+ * @name    slab_unlink
+ * @brief   Removes s from the list starting at *list.
+ */
+static void slab_unlink(Slab ** list, Slab * s) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        *list = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+}
+
+/**
+ * @name    slab_push
+ * @brief   Puts s at the front of the list starting at *list.
+ */
+static void slab_push(Slab ** list, Slab * s) {
+    s->prev = NULL;
+    s->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = s;
+    }
+    *list = s;
+}
+
+/**
+ * @name    slab_new
+ * @brief   Takes a new slab for cache from the arenas, with all slots free.
+ * @retval  The new slab, or NULL if no aligned block of SLAB_SIZE bytes is available.
+ */
+static Slab * slab_new(SlabCache * cache) {
+    BlockHeader * block = arena_alloc(block_size(SLAB_SIZE), SLAB_SIZE, NULL);
+    Slab * s;
+    uint32_t i;
+
+    if (block == NULL) return NULL;
+    s = (Slab *) block->user_block;
+    s->cache = cache;
+    s->used = 0;
+    s->hint = 0;
+    for (i = 0; i < cache->words; i++) {
+        s->bitmap[i] = ~(uint64_t) 0;
+    }
+    if (cache->slots % 64) {
+        s->bitmap[cache->words - 1] = ((uint64_t) 1 << (cache->slots % 64)) - 1;
+    }
+    return s;
+}
+
+SlabCache * simple_slab_create(size_t size) {
+    SlabCache * cache;
+    BlockHeader * block;
+    uint32_t slots;
+    size_t offset, dirty;
+
+    size = align_up(size ? size : 1, sizeof(uintptr_t));
+    if (size > SLAB_SIZE / SLAB_MIN_SLOTS) return NULL;
+
+    // Find the largest number of slots that fits together with the header and bitmap
+    slots = (SLAB_SIZE - sizeof(Slab)) / size;
+    do {
+        offset = align_up(sizeof(Slab) + (slots + 63) / 64 * sizeof(uint64_t), sizeof(uintptr_t));
+    } while (offset + slots * size > SLAB_SIZE && --slots > 0);
+
+    block = allocate(sizeof(SlabCache), &dirty);
+    if (block == NULL) return NULL;
+    cache = (SlabCache *) block->user_block;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->size = size;
+    cache->slots = slots;
+    cache->words = (slots + 63) / 64;
+    cache->offset = offset;
+    cache->partial = NULL;
+    cache->full = NULL;
+    return cache;
+}
+
+void * simple_slab_alloc(SlabCache * cache) {
+    Slab * s;
+    uint32_t i, bit;
+
+    pthread_mutex_lock(&cache->lock);
+    s = cache->partial;
+    if (s == NULL) {
+        s = slab_new(cache);
+        if (s == NULL) {
+            pthread_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+        slab_push(&cache->partial, s);
+    }
+
+    // A partial slab always has a free slot at or after the hint
+    for (i = s->hint; s->bitmap[i] == 0; i++);
+    bit = __builtin_ctzll(s->bitmap[i]);
+    s->bitmap[i] &= s->bitmap[i] - 1;
+    s->hint = i;
+    if (++s->used == cache->slots) {
+        slab_unlink(&cache->partial, s);
+        slab_push(&cache->full, s);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return (void *) ((uintptr_t) s + cache->offset + (i * 64 + bit) * cache->size);
+}
+
+void simple_slab_free(SlabCache * cache, void * ptr) {
+    Slab * s;
+    uint32_t slot;
+
+    if (ptr == NULL) return;
+    s = SLAB_OF(ptr);
+    if (s->cache != cache) return;   // Not an object of this cache
+
+    slot = ((uintptr_t) ptr - (uintptr_t) s - cache->offset) / cache->size;
+
+    pthread_mutex_lock(&cache->lock);
+    if (s->bitmap[slot / 64] & ((uint64_t) 1 << (slot % 64))) {
+        pthread_mutex_unlock(&cache->lock);
+        return;   // Slot is already free
+    }
+    s->bitmap[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    if (slot / 64 < s->hint) s->hint = slot / 64;
+
+    if (s->used-- == cache->slots) {
+        slab_unlink(&cache->full, s);
+        slab_push(&cache->partial, s);
+    } else if (s->used == 0 && (s->prev != NULL || s->next != NULL)) {
+        // Give an empty slab back to the arenas unless it is the only one left
+        slab_unlink(&cache->partial, s);
+        s->cache = NULL;
+        release(s);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void simple_slab_destroy(SlabCache * cache) {
+    Slab * lists[2];
+    Slab * s;
+    int i;
+
+    if (cache == NULL) return;
+    lists[0] = cache->partial;
+    lists[1] = cache->full;
+    for (i = 0; i < 2; i++) {
+        while (lists[i] != NULL) {
+            s = lists[i];
+            lists[i] = s->next;
+            s->cache = NULL;
+            release(s);
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    release(cache);
+}
@@ -0,0 +1,184 @@
+/* Trace recorder to be included in mm.c, before the public functions that use it */
+
+/*
+ * While tracing, every public call appends a TraceRecord to a ring buffer
+ * and a flusher thread writes the records to the trace file in the order
+ * their slots were claimed. A slot is claimed after the call got its block
+ * but before it gives one back, so a block handed out again is always
+ * recorded after it was freed. Callers only wait when the ring is full.
+ *
+ * A slot is ready once its seq is one above its index. Callers announce
+ * themselves in trace_writers, so stopping can wait for the last of them
+ * before the ring goes away.
+ */
+#define TRACE_RING       (1 << 16)   // Records buffered before callers wait for the flusher
+#define TRACE_BATCH      (256)       // Records written at once
+#define TRACE_IDLE_NS    (1000000)   // Sleep of the flusher when there is nothing to write
+
+typedef struct trace_slot {
+    TraceRecord rec;
+    uint64_t seq;
+} TraceSlot;
+
+static TraceSlot * trace_ring = NULL;
+static int tracing = 0;                  // Set while calls are recorded, only accessed atomically
+static int trace_stopping = 0;           // Tells the flusher to finish, only accessed atomically
+static unsigned int trace_writers = 0;   // Callers between checking tracing and publishing their slot
+static uint64_t trace_head = 0;          // Next slot to claim, only accessed atomically
+static uint64_t trace_tail = 0;          // Next slot to write, only accessed atomically
+static int trace_fd = -1;
+static pthread_t trace_thread;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;   // Serializes starting and stopping
+static uint16_t trace_threads = 0;       // Threads numbered so far
+static _Thread_local uint16_t trace_tid = 0;
+
+/**
+ * @name    trace_write
+ * @brief   Writes all of buf to the trace file. Records that cannot be written are lost.
+ */
+static void trace_write(const void * buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(trace_fd, buf, len);
+        if (n <= 0) return;
+        buf = (const char *) buf + n;
+        len -= (size_t) n;
+    }
+}
+
+/**
+ * @name    trace_flusher
+ * @brief   Writes ready records to the trace file until tracing stops and all are written.
+ */
+static void * trace_flusher(void * arg) {
+    TraceRecord buf[TRACE_BATCH];
+    struct timespec idle = { 0, TRACE_IDLE_NS };
+    uint64_t tail = 0;
+    int n, stopping;
+
+    for (;;) {
+        // Checked first, so no record published before it was set is missed
+        stopping = __atomic_load_n(&trace_stopping, __ATOMIC_ACQUIRE);
+        for (n = 0; n < TRACE_BATCH; n++) {
+            TraceSlot * slot = &trace_ring[(tail + n) % TRACE_RING];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + n + 1) break;
+            buf[n] = slot->rec;
+        }
+        if (n > 0) {
+            trace_write(buf, n * sizeof(TraceRecord));
+            tail += n;
+            __atomic_store_n(&trace_tail, tail, __ATOMIC_RELEASE);
+        } else if (stopping) {
+            break;
+        } else {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @name    trace_record
+ * @brief   Records a call in the next slot of the ring.
+ *
+ * @param   void * addr Block returned by the call, or freed by it.
+ * @param   uintptr_t old Block passed to simple_realloc, or the alignment for simple_aligned_alloc.
+ */
+static void trace_record(TraceOp op, void * addr, uintptr_t old, size_t size) {
+    TraceSlot * slot;
+    uint64_t i;
+
+    __atomic_fetch_add(&trace_writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&tracing, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_sub(&trace_writers, 1, __ATOMIC_RELEASE);
+        return;   // Stopped meanwhile
+    }
+    if (trace_tid == 0) {
+        trace_tid = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+    }
+
+    i = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    while (i - __atomic_load_n(&trace_tail, __ATOMIC_ACQUIRE) >= TRACE_RING) {
+        sched_yield();   // Ring full, wait for the flusher
+    }
+    slot = &trace_ring[i % TRACE_RING];
+    slot->rec.time = ticks();
+    slot->rec.addr = (uint64_t) (uintptr_t) addr;
+    slot->rec.old = (uint64_t) old;
+    slot->rec.size = (size < UINT32_MAX) ? (uint32_t) size : UINT32_MAX;
+    slot->rec.thread = trace_tid;
+    slot->rec.op = (uint8_t) op;
+    slot->rec.pad = 0;
+    __atomic_store_n(&slot->seq, i + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_sub(&trace_writers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @name    trace
+ * @brief   Records a call if tracing is on, see trace_record.
+ */
+static inline void trace(TraceOp op, void * addr, uintptr_t old, size_t size) {
+    if (__atomic_load_n(&tracing, __ATOMIC_RELAXED)) trace_record(op, addr, old, size);
+}
+
+/**
+ * @name    trace_open
+ * @brief   Creates the trace file and the ring and starts the flusher. Called with trace_lock held.
+ * @retval  0 if ok, -1 if not possible.
+ */
+static int trace_open(const char * path) {
+    static const char magic[8] = MM_TRACE_MAGIC;
+    void * ring;
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace_fd < 0) return -1;
+    ring = mmap(NULL, TRACE_RING * sizeof(TraceSlot), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        close(trace_fd);
+        return -1;
+    }
+    trace_ring = ring;
+    trace_write(magic, sizeof(magic));
+
+    trace_head = 0;
+    trace_tail = 0;
+    trace_stopping = 0;
+    if (pthread_create(&trace_thread, NULL, trace_flusher, NULL) != 0) {
+        munmap(trace_ring, TRACE_RING * sizeof(TraceSlot));
+        close(trace_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int simple_trace_start(const char * path) {
+    static int at_exit = 0;
+    int ret = -1;
+
+    pthread_mutex_lock(&trace_lock);
+    if (!__atomic_load_n(&tracing, __ATOMIC_RELAXED) && trace_open(path) == 0) {
+        __atomic_store_n(&tracing, 1, __ATOMIC_SEQ_CST);
+        // Whatever is still buffered when the program ends is written then
+        if (!at_exit) at_exit = (atexit(simple_trace_stop) == 0);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return ret;
+}
+
+void simple_trace_stop(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (__atomic_load_n(&tracing, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&tracing, 0, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&trace_writers, __ATOMIC_ACQUIRE) != 0) {
+            sched_yield();
+        }
+        __atomic_store_n(&trace_stopping, 1, __ATOMIC_RELEASE);
+        pthread_join(trace_thread, NULL);
+        munmap(trace_ring, TRACE_RING * sizeof(TraceSlot));
+        close(trace_fd);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}